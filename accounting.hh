@@ -0,0 +1,190 @@
+#ifndef ACCOUNTING_HH
+#define ACCOUNTING_HH
+
+/*
+ * Resources used by each job, as given by wait4():  user and system
+ * CPU time, peak resident set size, and block input and output, as well
+ * as the wall-clock time.  Jobs are only recorded with the -z option,
+ * which then outputs for each resource the targets that used most of
+ * it, and the same per parametrized rule, and with the -A option, which
+ * writes one line per job to a file as tab-separated values.
+ *
+ * Per rule, times and block operations are summed over the jobs of the
+ * rule, while the resident set size is the maximum.  Copy rules run
+ * within Stu (see copy.hh) use no resources of their own, and thus
+ * only have a wall-clock time.
+ */
+
+#include <sys/resource.h>
+
+class Accounting
+{
+public:
+	static const char *filename;
+	/* Set by the -A option; null when not used */
+
+	static bool enabled() {
+		return option_statistics || filename;
+	}
+
+	static void add(const string &target, const string &rule,
+			const struct rusage &rusage, long rss,
+			double time_wall, int status);
+	/* Record a job that has finished.  RULE identifies the
+	 * parametrized rule; RSS is in kilobytes.  STATUS is as returned
+	 * by waitpid().  */
+
+	static void print_statistics();
+	/* Output the jobs and rules that used most resources, regardless
+	 * of OPTION_STATISTICS.  Nothing is output when no job was
+	 * run.  */
+
+	static void write();
+	/* Write the file given by -A, if used.  Exit on errors.  */
+
+private:
+	static const size_t count_top= 5;
+	/* Number of targets and rules output per resource */
+
+	enum {
+		R_WALL, R_USER, R_SYSTEM, R_RSS, R_INBLOCK, R_OUTBLOCK,
+		R_COUNT
+	};
+
+	static const char *const names[R_COUNT];
+	static const char *const units[R_COUNT];
+
+	struct Entry
+	{
+		string target, rule;
+		double values[R_COUNT];
+		int status;
+	};
+
+	static vector <Entry> entries;
+
+	static void print_top(const vector <pair <string, double> > &items,
+			      const char *kind, int resource);
+
+	static string format_tsv(const string &text);
+	/* Escape backslashes, tabs and newlines */
+};
+
+const char *Accounting::filename= nullptr;
+const char *const Accounting::names[R_COUNT]=
+	{"wall-clock time", "user time", "system time",
+	 "peak resident set size", "block input operations",
+	 "block output operations"};
+const char *const Accounting::units[R_COUNT]=
+	{" s", " s", " s", " kB", "", ""};
+vector <Accounting::Entry> Accounting::entries;
+
+void Accounting::add(const string &target, const string &rule,
+		     const struct rusage &rusage, long rss,
+		     double time_wall, int status)
+{
+	assert(enabled());
+	Entry entry;
+	entry.target= target;
+	entry.rule= rule;
+	entry.values[R_WALL]= time_wall;
+	entry.values[R_USER]= rusage.ru_utime.tv_sec + rusage.ru_utime.tv_usec * 1e-6;
+	entry.values[R_SYSTEM]= rusage.ru_stime.tv_sec + rusage.ru_stime.tv_usec * 1e-6;
+	entry.values[R_RSS]= rss;
+	entry.values[R_INBLOCK]= rusage.ru_inblock;
+	entry.values[R_OUTBLOCK]= rusage.ru_oublock;
+	entry.status= status;
+	entries.push_back(entry);
+}
+
+void Accounting::print_statistics()
+{
+	if (entries.empty())
+		return;
+
+	for (int r= 0;  r < R_COUNT;  ++r) {
+		vector <pair <string, double> > items_target;
+		map <string, double> values_rule;
+		for (const Entry &entry:  entries) {
+			double value= entry.values[r];
+			items_target.push_back({entry.target, value});
+			double &value_rule= values_rule[entry.rule];
+			value_rule= r == R_RSS ? max(value_rule, value)
+				: value_rule + value;
+		}
+		vector <pair <string, double> > items_rule
+			(values_rule.begin(), values_rule.end());
+		print_top(items_target, "targets", r);
+		print_top(items_rule, "rules", r);
+	}
+}
+
+void Accounting::write()
+{
+	if (! filename)
+		return;
+
+	FILE *file= fopen(filename, "w");
+	if (file == nullptr) {
+		print_error_system(filename);
+		exit(ERROR_FATAL);
+	}
+	fputs("target\trule\twall\tuser\tsystem\trss\tinblock\toutblock\tstatus\n", file);
+	for (const Entry &entry:  entries) {
+		fprintf(file, "%s\t%s\t%.6f\t%.6f\t%.6f\t%.0f\t%.0f\t%.0f\t",
+			format_tsv(entry.target).c_str(),
+			format_tsv(entry.rule).c_str(),
+			entry.values[R_WALL], entry.values[R_USER],
+			entry.values[R_SYSTEM], entry.values[R_RSS],
+			entry.values[R_INBLOCK], entry.values[R_OUTBLOCK]);
+		/* The exit status, or the negative signal number */
+		if (WIFEXITED(entry.status))
+			fprintf(file, "%d\n", WEXITSTATUS(entry.status));
+		else if (WIFSIGNALED(entry.status))
+			fprintf(file, "%d\n", - WTERMSIG(entry.status));
+		else
+			fputs("\n", file);
+	}
+	if (fclose(file) != 0) {
+		print_error_system(filename);
+		exit(ERROR_FATAL);
+	}
+}
+
+void Accounting::print_top(const vector <pair <string, double> > &items,
+			   const char *kind, int resource)
+{
+	vector <pair <string, double> > items_sorted= items;
+	size_t count= items_sorted.size() < count_top
+		? items_sorted.size() : count_top;
+	partial_sort(items_sorted.begin(), items_sorted.begin() + count,
+		     items_sorted.end(),
+		     [](const pair <string, double> &a, const pair <string, double> &b) {
+			     return a.second > b.second;
+		     });
+	printf("STATISTICS  %s with the largest %s:\n", kind, names[resource]);
+	for (size_t i= 0;  i < count;  ++i) {
+		if (resource <= R_SYSTEM)
+			printf("STATISTICS    %12.3f%s  %s\n", items_sorted[i].second,
+			       units[resource], items_sorted[i].first.c_str());
+		else
+			printf("STATISTICS    %12.0f%s  %s\n", items_sorted[i].second,
+			       units[resource], items_sorted[i].first.c_str());
+	}
+}
+
+string Accounting::format_tsv(const string &text)
+{
+	string ret;
+	for (const char c:  text) {
+		switch (c) {
+		default:    ret += c;      break;
+		case '\\':  ret += "\\\\";  break;
+		case '\t':  ret += "\\t";  break;
+		case '\n':  ret += "\\n";  break;
+		}
+	}
+	return ret;
+}
+
+#endif /* ! ACCOUNTING_HH */
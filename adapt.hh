@@ -0,0 +1,221 @@
+#ifndef ADAPT_HH
+#define ADAPT_HH
+
+/*
+ * Adaptive number of parallel jobs, used with the -L option.  The
+ * number of jobs given by -j is then only the maximum, and the actual
+ * limit is adapted between the value given by -L and that maximum,
+ * according to how much the system is under pressure.  This is useful
+ * on shared machines, where a fixed value is either too low, wasting
+ * processors, or too high, making the machine thrash.
+ *
+ * The pressure is taken from Linux's pressure stall information (PSI)
+ * in /proc/pressure/{cpu,memory,io}, i.e., the percentage of time in
+ * which some tasks were stalled on the resource, averaged over ten
+ * seconds.  When PSI is not available, the load average is compared to
+ * the number of processors instead.
+ *
+ * The pressure is sampled at most once per interval, after jobs have
+ * finished, and when Stu is woken up after the interval while waiting
+ * for jobs.  When the pressure on any resource is above its high
+ * threshold, the limit is decreased by a quarter; when the pressure on
+ * all resources is below their low thresholds, the limit is increased
+ * by a quarter (at least by one).  The limit starts at the minimum.
+ *
+ * The limit is applied through Execution::jobs, the number of free
+ * slots.  When the limit is decreased by more than the number of free
+ * slots, the difference is owed, and taken from the slots of jobs as
+ * they finish.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+class Adapt
+{
+public:
+	static long jobs_min;
+	/* Set by the -L option; zero when not used */
+
+	static void init(long &jobs);
+	/* Called before the build with the value of the -j option in
+	 * JOBS; set JOBS to the initial limit, and let Job::wait() wake
+	 * up after each interval */
+
+	static long get_jobs_max() {  return jobs_max;  }
+	/* The value of the -j option; only valid after init() */
+
+	static string update(long &jobs);
+	/* Called after jobs have finished, with JOBS being the number
+	 * of free slots.  Sample the pressure if the interval has
+	 * passed, and change JOBS accordingly.  Return a description of
+	 * the decision for debug mode, or "" when nothing was
+	 * sampled.  */
+
+	static void print_statistics();
+	/* Print the decisions taken, regardless of OPTION_STATISTICS.
+	 * Nothing is printed when the option -L is not used, or when no
+	 * build was done.  */
+
+private:
+	static const double interval;
+	/* Minimal time between two samples, in seconds.  The averages
+	 * of PSI are updated every two seconds.  */
+
+	static const double thresholds_high[3], thresholds_low[3];
+	/* For CPU, memory and I/O, in percent */
+
+	static const double load_high, load_low;
+	/* Thresholds for the load average divided by the number of
+	 * processors, when PSI is not available */
+
+	static long jobs_max;
+	/* The value of the -j option */
+
+	static long limit;
+	/* The current limit; zero before init() */
+
+	static long owed;
+	/* Number of slots that must still be taken from running jobs
+	 * when they finish */
+
+	static double time_last;
+	/* Time of the last sample, as returned by Job::get_time() */
+
+	static double time_limit;
+	/* The integral of LIMIT over time since the start, for the mean */
+
+	static double time_start;
+
+	static long limit_lowest, limit_highest;
+	static size_t count_samples, count_raised, count_lowered;
+
+	static bool read_pressure(const char *resource, double &pressure);
+	/* Read the "some avg10" value from the PSI file of the given
+	 * resource.  Return false when not available.  */
+};
+
+const double Adapt::interval= 2.0;
+const double Adapt::thresholds_high[3]= {60, 10, 40};
+const double Adapt::thresholds_low[3]=  {20,  2, 10};
+const double Adapt::load_high= 1.5;
+const double Adapt::load_low=  0.8;
+long Adapt::jobs_min= 0;
+long Adapt::jobs_max;
+long Adapt::limit= 0;
+long Adapt::owed= 0;
+double Adapt::time_last;
+double Adapt::time_limit= 0;
+double Adapt::time_start;
+long Adapt::limit_lowest, Adapt::limit_highest;
+size_t Adapt::count_samples= 0;
+size_t Adapt::count_raised= 0;
+size_t Adapt::count_lowered= 0;
+
+void Adapt::init(long &jobs)
+{
+	assert(jobs_min > 0 && jobs_min <= jobs);
+	jobs_max= jobs;
+	limit= limit_lowest= limit_highest= jobs_min;
+	jobs= limit;
+	time_start= time_last= Job::get_time();
+	Job::timeout_wait= (int) (interval * 1000);
+}
+
+string Adapt::update(long &jobs)
+{
+	if (jobs_min == 0)
+		return "";
+
+	/* Take the owed slots from finished jobs */
+	long settled= min(owed, jobs);
+	owed -= settled;
+	jobs -= settled;
+
+	double now= Job::get_time();
+	if (now - time_last < interval)
+		return "";
+	time_limit += limit * (now - time_last);
+	time_last= now;
+	++count_samples;
+
+	static const char *const resources[3]= {"cpu", "memory", "io"};
+	double pressures[3];
+	bool high= false, low= true;
+	string text;
+	if (read_pressure(resources[0], pressures[0])
+	    && read_pressure(resources[1], pressures[1])
+	    && read_pressure(resources[2], pressures[2])) {
+		for (int i= 0;  i < 3;  ++i) {
+			if (pressures[i] > thresholds_high[i])
+				high= true;
+			if (pressures[i] >= thresholds_low[i])
+				low= false;
+		}
+		text= frmt("pressure cpu = %.2f, memory = %.2f, io = %.2f",
+			   pressures[0], pressures[1], pressures[2]);
+	} else {
+		double load;
+		long count_processors= sysconf(_SC_NPROCESSORS_ONLN);
+		if (getloadavg(&load, 1) != 1 || count_processors < 1)
+			return "adapt: no pressure information";
+		double ratio= load / count_processors;
+		high= ratio > load_high;
+		low= ratio < load_low;
+		text= frmt("load = %.2f, processors = %ld", load, count_processors);
+	}
+
+	long limit_new= limit;
+	if (high)
+		limit_new= max(jobs_min, limit - max(1L, limit / 4));
+	else if (low)
+		limit_new= min(jobs_max, limit + max(1L, limit / 4));
+
+	if (limit_new > limit) {
+		++count_raised;
+		long delta= limit_new - limit;
+		long forgiven= min(owed, delta);
+		owed -= forgiven;
+		jobs += delta - forgiven;
+	} else if (limit_new < limit) {
+		++count_lowered;
+		long delta= limit - limit_new;
+		long taken= min(jobs, delta);
+		jobs -= taken;
+		owed += delta - taken;
+	}
+	limit_lowest= min(limit_lowest, limit_new);
+	limit_highest= max(limit_highest, limit_new);
+
+	text= frmt("adapt: %s, limit %ld -> %ld", text.c_str(), limit, limit_new);
+	limit= limit_new;
+	return text;
+}
+
+void Adapt::print_statistics()
+{
+	if (limit == 0)
+		return;
+	double now= Job::get_time();
+	double mean= now > time_start
+		? (time_limit + limit * (now - time_last)) / (now - time_start)
+		: limit;
+	printf("STATISTICS  adaptive jobs:  samples = %zu, raised = %zu, lowered = %zu\n",
+	       count_samples, count_raised, count_lowered);
+	printf("STATISTICS  adaptive jobs:  limit = %ld (lowest %ld, highest %ld, mean %.1f)\n",
+	       limit, limit_lowest, limit_highest, mean);
+}
+
+bool Adapt::read_pressure(const char *resource, double &pressure)
+{
+	string filename= frmt("/proc/pressure/%s", resource);
+	FILE *file= fopen(filename.c_str(), "r");
+	if (file == nullptr)
+		return false;
+	int n= fscanf(file, "some avg10=%lf", &pressure);
+	fclose(file);
+	return n == 1;
+}
+
+#endif /* ! ADAPT_HH */
@@ -10,7 +10,8 @@
  * created.
  */
 
-#include <queue>
+#include <algorithm>
+#include <deque>
 #include <random>
 
 static default_random_engine buffer_generator;
@@ -34,7 +35,7 @@ private:
 
 	/* All contained dependencies are normalized */
 
-	queue <shared_ptr <const Dep> > q;
+	deque <shared_ptr <const Dep> > q;
 	vector <shared_ptr <const Dep> > v;
 
 public:
@@ -60,7 +61,7 @@ public:
 			return ret; 
 		} else {
 			shared_ptr <const Dep> ret= q.front();
-			q.pop(); 
+			q.pop_front(); 
 			return ret; 
 		}
 	}
@@ -73,7 +74,7 @@ public:
 		if (order_vec) {
 			v.emplace_back(d); 
 		} else {
-			q.push(d); 
+			q.push_back(d); 
 		}
 	}
 
@@ -84,6 +85,36 @@ public:
 			return q.empty(); 
 		}
 	}
+
+	template <typename Key>
+	void sort(Key key)
+	/* Order the elements by decreasing KEY(), keeping the order of
+	 * elements with the same key.  Not used in random mode.  */
+	{
+		assert(! order_vec); 
+		if (q.size() < 2)
+			return; 
+		vector <pair <double, shared_ptr <const Dep> > > elements;
+		for (const auto &d:  q) 
+			elements.emplace_back(key(d), d); 
+		stable_sort(elements.begin(), elements.end(),
+			    [](const pair <double, shared_ptr <const Dep> > &a,
+			       const pair <double, shared_ptr <const Dep> > &b) {
+				    return a.first > b.first; 
+			    }); 
+		for (size_t i= 0;  i < elements.size();  ++i)
+			q[i]= elements[i].second; 
+	}
+
+	void get_all(vector <shared_ptr <const Dep> > &deps) const
+	/* Append all contained dependencies to DEPS, without removing
+	 * them from the buffer */
+	{
+		if (order_vec) 
+			deps.insert(deps.end(), v.begin(), v.end());
+		else
+			deps.insert(deps.end(), q.begin(), q.end()); 
+	}
 };
 
 #endif /* ! BUFFER_HH */
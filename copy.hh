@@ -0,0 +1,387 @@
+#ifndef COPY_HH
+#define COPY_HH
+
+/*
+ * Copy rules executed by Stu itself, instead of by calling 'cp'.  This
+ * avoids starting a process for each copy rule.  When $STU_CP is set,
+ * the given program is called as before.
+ *
+ * The copying is done by a small pool of threads, such that Stu can
+ * continue to start and wait for other jobs meanwhile.  Each copy gets
+ * an ID that is used in place of a process ID.  The IDs are larger than
+ * any process ID on all supported systems, and are never passed to
+ * kill().  When a copy has finished, the thread sends SIGCHLD to Stu,
+ * which wakes up Job::wait() in the same way as a finished child
+ * process, and Job::wait() then returns the ID together with a status
+ * as returned by waitpid().  A copy that failed has exit status 1, as
+ * 'cp' would have.
+ *
+ * The file is copied using a reflink (ioctl(FICLONE)) where the
+ * filesystem supports it, then using copy_file_range(), and otherwise
+ * using read() and write().  Like 'cp' without options, the target
+ * file is created with the permissions of the source file (minus the
+ * umask) or truncated if it exists, and thus gets the current time as
+ * its timestamp.
+ *
+ * The threads only do the copying and wait for work.  All signals are
+ * blocked in them, such that signals are handled by the main thread as
+ * before.
+ *
+ * When Stu terminates all jobs, cancel() is called from the main thread,
+ * possibly within a signal handler.  Queued copies are then not started,
+ * and running copies stop at the next chunk and remove their partial
+ * target (unless -K is used).  cancel() returns only when no thread is
+ * copying anymore, such that no thread creates or writes a target after
+ * Stu has removed partially built files, or while Stu exits.  Since
+ * mutexes cannot be used in signal handlers, this uses only atomic
+ * variables.
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#    include <sys/ioctl.h>
+#    include <linux/fs.h>
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+class Copy
+{
+public:
+	static const pid_t id_min= 0x40000000;
+	/* All IDs of copies are at least this large.  Process IDs are
+	 * at most 2^22 on Linux, and smaller on other systems.  */
+
+	static bool is_copy(pid_t pid) {
+		return pid >= id_min;
+	}
+	/* [ASYNC-SIGNAL-SAFE] */
+
+	static pid_t start(const string &target, const string &source);
+	/* Start copying SOURCE to TARGET, and return the ID of the copy */
+
+	static pid_t finished(int *status);
+	/* Return the ID of a finished copy and set STATUS, or return 0
+	 * when no copy has finished.  When the copy failed, output the
+	 * error message.  */
+
+	static size_t count_running() {  return count;  }
+	/* Number of copies started for which finished() has not yet
+	 * returned */
+
+	static void cancel();
+	/* Do not start queued copies, stop running copies, and wait until
+	 * no thread is copying anymore.  Finished() does not return
+	 * copies afterwards.  [ASYNC-SIGNAL-SAFE] */
+
+private:
+	static const size_t count_threads= 4;
+	/* Number of threads.  Copying is limited by the filesystem, and
+	 * the number of copies at once is limited by the -j option,
+	 * therefore a few threads are enough.  */
+
+	struct Task
+	{
+		pid_t id;
+		string target, source;
+
+		int errno_copy;
+		/* Zero on success */
+
+		const string *filename_error;
+		/* The file to which ERRNO_COPY refers; points to TARGET or
+		 * SOURCE */
+	};
+
+	struct Queue
+	/* Never deleted, because the threads may still be waiting on it
+	 * when the program exits */
+	{
+		deque <Task *> todo, done;
+		mutex m;
+		condition_variable cond_todo;
+		/* Protects TODO and DONE */
+	};
+
+	static Queue *queue;
+	/* Null when the threads were not started yet */
+
+	static pid_t id_next;
+
+	static size_t count;
+
+	static atomic <bool> cancelled;
+
+	static atomic <size_t> count_active;
+	/* Number of threads that took a task and may be copying.  A
+	 * thread increments it before checking CANCELLED, such that
+	 * cancel() either sees the thread as active, or the thread sees
+	 * CANCELLED.  */
+
+	static void start_threads();
+	static void run_thread();
+
+	static void copy(Task *task);
+	/* Do the copying; set ERRNO_COPY and FILENAME_ERROR */
+
+	static bool copy_data(int fd_in, int fd_out, off_t size);
+	/* Copy the whole content; return false and set ERRNO on error.
+	 * When cancelled, return false with ERRNO set to ECANCELED.  */
+};
+
+Copy::Queue *Copy::queue= nullptr;
+pid_t Copy::id_next= Copy::id_min;
+size_t Copy::count= 0;
+atomic <bool> Copy::cancelled(false);
+atomic <size_t> Copy::count_active(0);
+
+pid_t Copy::start(const string &target, const string &source)
+{
+	start_threads();
+
+	Task *task= new Task;
+	task->id= id_next;
+	task->target= target;
+	task->source= source;
+	task->errno_copy= 0;
+	task->filename_error= nullptr;
+
+	/* Start again at the beginning after a very large number of
+	 * copies; the IDs are only used while a copy is running */
+	id_next= id_next == INT_MAX ? id_min : id_next + 1;
+	++count;
+
+	{
+		unique_lock <mutex> lock(queue->m);
+		queue->todo.push_back(task);
+	}
+	queue->cond_todo.notify_one();
+
+	return task->id;
+}
+
+pid_t Copy::finished(int *status)
+{
+	if (count == 0)
+		return 0;
+
+	Task *task;
+	{
+		unique_lock <mutex> lock(queue->m);
+		if (queue->done.empty() || cancelled)
+			return 0;
+		task= queue->done.front();
+		queue->done.pop_front();
+	}
+	--count;
+
+	if (task->errno_copy) {
+		errno= task->errno_copy;
+		print_error_system(*task->filename_error);
+	}
+
+	/* The encoding used by waitpid() for exit status 0 or 1 on all
+	 * supported systems */
+	*status= task->errno_copy ? 1 << 8 : 0;
+	assert(WIFEXITED(*status));
+	assert(WEXITSTATUS(*status) == (task->errno_copy ? 1 : 0));
+
+	pid_t id= task->id;
+	delete task;
+	return id;
+}
+
+void Copy::cancel()
+{
+	/* [ASYNC-SIGNAL-SAFE] We use only async signal-safe functions here */
+
+	cancelled= true;
+
+	/* The threads check CANCELLED at least after each chunk */
+	while (count_active != 0) {
+		struct timespec t= {0, 1000000};
+		nanosleep(&t, nullptr);
+	}
+}
+
+void Copy::start_threads()
+{
+	if (queue)
+		return;
+	queue= new Queue;
+
+	/* Threads inherit the signal mask */
+	sigset_t set_all, set_old;
+	sigfillset(&set_all);
+	if (0 != pthread_sigmask(SIG_BLOCK, &set_all, &set_old)) {
+		perror("pthread_sigmask");
+		exit(ERROR_FATAL);
+	}
+
+	for (size_t i= 0;  i < count_threads;  ++i) {
+		thread t(run_thread);
+		t.detach();
+	}
+
+	if (0 != pthread_sigmask(SIG_SETMASK, &set_old, nullptr)) {
+		perror("pthread_sigmask");
+		exit(ERROR_FATAL);
+	}
+}
+
+void Copy::run_thread()
+{
+	while (true) {
+		Task *task;
+		{
+			unique_lock <mutex> lock(queue->m);
+			while (queue->todo.empty())
+				queue->cond_todo.wait(lock);
+			task= queue->todo.front();
+			queue->todo.pop_front();
+		}
+
+		++count_active;
+		if (cancelled) {
+			/* Leave the task in no queue; it is not needed
+			 * anymore */
+			--count_active;
+			continue;
+		}
+		copy(task);
+		--count_active;
+		if (cancelled)
+			continue;
+
+		{
+			unique_lock <mutex> lock(queue->m);
+			queue->done.push_back(task);
+		}
+
+		/* Wake up the main thread, which has SIGCHLD blocked and
+		 * waits for it */
+		kill(getpid(), SIGCHLD);
+	}
+}
+
+void Copy::copy(Task *task)
+{
+	int fd_in= open(task->source.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd_in < 0) {
+		task->errno_copy= errno;
+		task->filename_error= &task->source;
+		return;
+	}
+
+	struct stat buf;
+	if (fstat(fd_in, &buf) < 0) {
+		task->errno_copy= errno;
+		task->filename_error= &task->source;
+		close(fd_in);
+		return;
+	}
+	if (S_ISDIR(buf.st_mode)) {
+		task->errno_copy= EISDIR;
+		task->filename_error= &task->source;
+		close(fd_in);
+		return;
+	}
+
+	/* Do not create or truncate the target when cancelled meanwhile */
+	if (cancelled) {
+		close(fd_in);
+		return;
+	}
+
+	int fd_out= open(task->target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			 buf.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO));
+	if (fd_out < 0) {
+		task->errno_copy= errno;
+		task->filename_error= &task->target;
+		close(fd_in);
+		return;
+	}
+
+	bool success= copy_data(fd_in, fd_out, buf.st_size);
+	if (! success) {
+		task->errno_copy= errno;
+		task->filename_error= &task->target;
+	}
+	close(fd_in);
+	if (cancelled) {
+		close(fd_out);
+		if (! option_no_delete)
+			unlink(task->target.c_str());
+		return;
+	}
+	if (close(fd_out) < 0 && success) {
+		task->errno_copy= errno;
+		task->filename_error= &task->target;
+	}
+}
+
+bool Copy::copy_data(int fd_in, int fd_out, off_t size)
+{
+#ifdef FICLONE
+	/* A reflink shares the data blocks of the two files */
+	if (size > 0 && ioctl(fd_out, FICLONE, fd_in) == 0)
+		return true;
+#endif
+
+	bool copied= false;
+	/* Whether anything was copied, in which case we cannot fall back
+	 * to another method */
+
+#ifdef __linux__
+	/* Copy within the kernel; does not work across filesystems on
+	 * older kernels */
+	while (true) {
+		if (cancelled) {
+			errno= ECANCELED;
+			return false;
+		}
+		/* In chunks small enough for cancel() not to wait long */
+		ssize_t r= copy_file_range(fd_in, nullptr, fd_out, nullptr,
+					   0x1000000, 0);
+		if (r == 0)
+			return true;
+		if (r < 0) {
+			if (copied || ! (errno == EXDEV || errno == ENOSYS ||
+					 errno == EINVAL || errno == EOPNOTSUPP))
+				return false;
+			break;
+		}
+		copied= true;
+	}
+#endif
+
+	(void) size;
+	(void) copied;
+	char mem[0x10000];
+	ssize_t len;
+	while ((len= read(fd_in, mem, sizeof(mem))) > 0) {
+		if (cancelled) {
+			errno= ECANCELED;
+			return false;
+		}
+		for (ssize_t done= 0;  done < len;) {
+			ssize_t r= write(fd_out, mem + done, len - done);
+			if (r < 0)
+				return false;
+			done += r;
+		}
+	}
+	return len == 0;
+}
+
+#endif /* ! COPY_HH */
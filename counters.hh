@@ -0,0 +1,163 @@
+#ifndef COUNTERS_HH
+#define COUNTERS_HH
+
+/*
+ * Counters and timers of the internal hot paths of Stu, to find out
+ * where Stu itself spends its time, e.g., when it is slow before
+ * starting any job.  They are always compiled in:  counting is a single
+ * increment, and timers are only used around paths that do enough work
+ * per call for the clock to be negligible.  They are output with the
+ * -z option, and written as a JSON object with the -Z option.
+ *
+ * Timers measure the wall-clock time of the monotonic clock.  When a
+ * timed path is entered recursively, only the outermost call is timed.
+ */
+
+#include "error.hh"
+#include "timestamp.hh"
+
+class Counters
+{
+public:
+	enum Counter {
+		C_TOKENIZER_BYTES,	/* Bytes of Stu scripts and dynamic dependencies tokenized */
+		C_RULE_GET,		/* Calls to Rule_Set::get() */
+		C_RULE_CANDIDATES,	/* Parametrized rules tried to match */
+		C_NAME_MATCH,		/* Calls to Name::match() */
+		C_CYCLE_NODES,		/* Executions visited by find_cycle() */
+		C_STAT,			/* Calls to stat(), lstat() and fstat() on targets */
+		C_OPEN,			/* Files opened for reading */
+		C_EXECUTION_FILE,	/* Execution objects created, per subclass */
+		C_EXECUTION_TRANSIENT,
+		C_EXECUTION_ROOT,
+		C_EXECUTION_CONCAT,
+		C_EXECUTION_DYNAMIC,
+		C_DEP_CLONE,		/* Calls to Dep::clone() */
+		C_DEP_NORMALIZE,	/* Calls to Dep::normalize() */
+		C_LOOP,			/* Iterations of the main loop */
+		C_WAIT,			/* Times the main loop waited for jobs */
+		C_EXECUTE_CHILD,	/* Children executed by execute_children() */
+		C_COUNT
+	};
+
+	enum Timer {
+		T_TOKENIZE,		/* Reading and tokenizing files */
+		T_RULE_GET,		/* Rule_Set::get() */
+		T_CYCLE,		/* find_cycle() */
+		T_EXECUTE,		/* Traversals of the dependency graph */
+		T_WAIT,			/* Waiting for jobs */
+		T_COUNT
+	};
+
+	static void add(Counter counter, size_t n= 1) {
+		counters[counter] += n;
+	}
+
+	class Timing
+	/* Time the lifetime of an object of this type */
+	{
+	public:
+		Timing(Timer timer_)
+			:  timer(timer_),
+			   time_begin(depths[timer]++ == 0 ? get_time_monotonic() : -1)
+		{  }
+
+		~Timing() {
+			if (--depths[timer] == 0)
+				timers[timer] += get_time_monotonic() - time_begin;
+		}
+
+	private:
+		const Timer timer;
+		const double time_begin;
+		/* Negative when nested */
+	};
+
+	static const char *filename;
+	/* Set by the -Z option; null when not used */
+
+	static void print_statistics();
+	/* Output all counters and timers, regardless of
+	 * OPTION_STATISTICS */
+
+	static void write();
+	/* Write the file given by -Z, if used.  Exit on errors.  */
+
+private:
+	static size_t counters[C_COUNT];
+	static double timers[T_COUNT];
+	static unsigned depths[T_COUNT];
+
+	static const char *const names_counters[C_COUNT];
+	static const char *const names_timers[T_COUNT];
+};
+
+size_t Counters::counters[C_COUNT];
+double Counters::timers[T_COUNT];
+unsigned Counters::depths[T_COUNT];
+const char *Counters::filename= nullptr;
+
+const char *const Counters::names_counters[C_COUNT]= {
+	"tokenizer_bytes",
+	"rule_get",
+	"rule_candidates",
+	"name_match",
+	"cycle_nodes",
+	"stat",
+	"open",
+	"execution_file",
+	"execution_transient",
+	"execution_root",
+	"execution_concat",
+	"execution_dynamic",
+	"dep_clone",
+	"dep_normalize",
+	"loop",
+	"wait",
+	"execute_child",
+};
+
+const char *const Counters::names_timers[T_COUNT]= {
+	"tokenize",
+	"rule_get",
+	"cycle",
+	"execute",
+	"wait",
+};
+
+void Counters::print_statistics()
+{
+	for (int i= 0;  i < C_COUNT;  ++i)
+		printf("STATISTICS  counter %s = %zu\n",
+		       names_counters[i], counters[i]);
+	for (int i= 0;  i < T_COUNT;  ++i)
+		printf("STATISTICS  timer %s = %.6f s\n",
+		       names_timers[i], timers[i]);
+}
+
+void Counters::write()
+{
+	if (! filename)
+		return;
+
+	FILE *file= fopen(filename, "w");
+	if (file == nullptr) {
+		print_error_system(filename);
+		exit(ERROR_FATAL);
+	}
+	fputs("{\n\t\"counters\": {\n", file);
+	for (int i= 0;  i < C_COUNT;  ++i)
+		fprintf(file, "\t\t\"%s\": %zu%s\n", names_counters[i], counters[i],
+			i + 1 < C_COUNT ? "," : "");
+	fputs("\t},\n\t\"timers\": {\n", file);
+	for (int i= 0;  i < T_COUNT;  ++i)
+		fprintf(file, "\t\t\"%s\": %.6f%s\n", names_timers[i], timers[i],
+			i + 1 < T_COUNT ? "," : "");
+	fputs("\t}\n}\n", file);
+	if (fclose(file) != 0) {
+		print_error_system(filename);
+		exit(ERROR_FATAL);
+	}
+}
+
+#endif /* ! COUNTERS_HH */
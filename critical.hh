@@ -0,0 +1,199 @@
+#ifndef CRITICAL_HH
+#define CRITICAL_HH
+
+/*
+ * Analysis of a build after the fact, output with the -z option:  the
+ * critical path, i.e., the chain of jobs that bounded the wall-clock
+ * time of the build, and the periods in which job slots were idle.
+ *
+ * For each job, the job that finished last among its direct and
+ * indirect dependencies is its predecessor; it is propagated through
+ * executions without a job, such as transient targets and dynamic
+ * dependencies.  The critical path starts at the job that finished
+ * last, and follows the predecessors.  Between two jobs of the path,
+ * the time in which neither ran is spent by Stu itself, e.g., reading
+ * dynamic dependencies, or waiting for a free job slot.
+ *
+ * A job slot is idle when fewer jobs than given by -j run.  Only
+ * periods before the last job was started are considered, as
+ * afterwards no work was left.  For each such period, the job started
+ * at its end is output, together with its predecessor.  Those jobs
+ * could not be started earlier, and are thus the place to look at when
+ * restructuring the dependencies.
+ */
+
+class Critical
+{
+public:
+	static bool enabled() {  return option_statistics;  }
+
+	static void init(long jobs_);
+	/* Called when the build starts, with the maximal number of
+	 * parallel jobs */
+
+	static ssize_t add(const string &target, double time_begin,
+			   double time_end, ssize_t predecessor);
+	/* Record a job that has finished.  PREDECESSOR is the index of
+	 * the job that finished last among the dependencies, or -1.
+	 * Return the index of the job.  */
+
+	static double get_time_end(ssize_t index) {
+		return entries.at(index).time_end;
+	}
+
+	static void print_statistics();
+	/* Output the critical path and the idle periods, regardless of
+	 * OPTION_STATISTICS.  Nothing is output when no job was run.  */
+
+private:
+	static const size_t count_top= 5;
+	/* Number of idle periods output */
+
+	struct Entry
+	{
+		string target;
+		double time_begin, time_end;
+		ssize_t predecessor;
+	};
+
+	struct Period
+	{
+		double time_begin, time_end;
+		double idle;
+		/* Sum of the idle time over all job slots */
+		ssize_t index;
+		/* The job started at the end of the period */
+	};
+
+	static long jobs;
+	static double time_start;
+	static vector <Entry> entries;
+
+	static void print_path();
+	static void print_periods();
+};
+
+long Critical::jobs= 1;
+double Critical::time_start= 0;
+vector <Critical::Entry> Critical::entries;
+
+void Critical::init(long jobs_)
+{
+	assert(jobs_ >= 1);
+	jobs= jobs_;
+	time_start= Job::get_time();
+}
+
+ssize_t Critical::add(const string &target, double time_begin,
+		      double time_end, ssize_t predecessor)
+{
+	assert(enabled());
+	assert(predecessor < (ssize_t) entries.size());
+	entries.push_back({target, time_begin, time_end, predecessor});
+	return entries.size() - 1;
+}
+
+void Critical::print_statistics()
+{
+	if (entries.empty())
+		return;
+	print_path();
+	print_periods();
+}
+
+void Critical::print_path()
+{
+	ssize_t last= 0;
+	for (size_t i= 1;  i < entries.size();  ++i)
+		if (entries[i].time_end > entries[last].time_end)
+			last= i;
+
+	vector <ssize_t> path;
+	double time_jobs= 0;
+	for (ssize_t i= last;  i >= 0;  i= entries[i].predecessor) {
+		path.push_back(i);
+		time_jobs += entries[i].time_end - entries[i].time_begin;
+	}
+
+	double time_wall= entries[last].time_end - time_start;
+	printf("STATISTICS  critical path:  %zu jobs, %.3f s in jobs of %.3f s wall-clock time\n",
+	       path.size(), time_jobs, time_wall);
+	for (auto i= path.rbegin();  i != path.rend();  ++i) {
+		const Entry &entry= entries[*i];
+		printf("STATISTICS    %10.3f s %10.3f s  %s\n",
+		       entry.time_begin - time_start,
+		       entry.time_end - time_start,
+		       entry.target.c_str());
+	}
+}
+
+void Critical::print_periods()
+{
+	/* Start and end times of jobs, with the index of the job, or
+	 * -1 for ends.  At equal times, ends come first.  */
+	vector <pair <double, ssize_t> > events;
+	double time_last_begin= time_start;
+	double time_jobs= 0, time_end= time_start;
+	for (size_t i= 0;  i < entries.size();  ++i) {
+		events.push_back({entries[i].time_begin, i});
+		events.push_back({entries[i].time_end, -1});
+		time_last_begin= max(time_last_begin, entries[i].time_begin);
+		time_end= max(time_end, entries[i].time_end);
+		time_jobs += entries[i].time_end - entries[i].time_begin;
+	}
+	sort(events.begin(), events.end());
+
+	vector <Period> periods;
+	double idle_sum= 0;
+	long running= 0;
+	double time_prev= time_start;
+	Period period= {time_start, 0, 0, -1};
+	for (const auto &event:  events) {
+		double time= event.first;
+		if (time > time_last_begin)
+			break;
+		if (running < jobs)
+			period.idle += (jobs - running) * (time - time_prev);
+		time_prev= time;
+		if (event.second < 0) {
+			if (running-- == jobs)
+				period.time_begin= time;
+			continue;
+		}
+		++running;
+		/* A period ends when all slots are used, or when the
+		 * last job starts */
+		if (running == jobs || time == time_last_begin) {
+			if (period.idle > 0) {
+				period.time_end= time;
+				period.index= event.second;
+				periods.push_back(period);
+				idle_sum += period.idle;
+			}
+			period= {time, 0, 0, -1};
+		}
+	}
+
+	double time_wall= time_end - time_start;
+	printf("STATISTICS  job slots:  %ld, utilization = %.1f %%, idle while jobs were left = %.3f s\n",
+	       jobs, time_wall > 0 ? 100 * time_jobs / (jobs * time_wall) : 0.0,
+	       idle_sum);
+
+	size_t count= periods.size() < count_top ? periods.size() : count_top;
+	partial_sort(periods.begin(), periods.begin() + count, periods.end(),
+		     [](const Period &a, const Period &b) {
+			     return a.idle > b.idle;
+		     });
+	for (size_t i= 0;  i < count;  ++i) {
+		const Period &p= periods[i];
+		const Entry &entry= entries[p.index];
+		printf("STATISTICS    %10.3f s %10.3f s  idle %.3f s, until %s",
+		       p.time_begin - time_start, p.time_end - time_start,
+		       p.idle, entry.target.c_str());
+		if (entry.predecessor >= 0)
+			printf(" after %s", entries[entry.predecessor].target.c_str());
+		putchar('\n');
+	}
+}
+
+#endif /* ! CRITICAL_HH */
@@ -48,6 +48,7 @@
 #include "error.hh"
 #include "target.hh"
 #include "flags.hh"
+#include "counters.hh"
 
 template <typename T, typename U>
 shared_ptr <const T> to(shared_ptr <const U> d)
@@ -583,6 +584,7 @@ void Dep::normalize(shared_ptr <const Dep> dep,
 		    vector <shared_ptr <const Dep> > &deps,
 		    int &error)
 {
+	Counters::add(Counters::C_DEP_NORMALIZE); 
 	if (to <Plain_Dep> (dep)) {
 		deps.push_back(dep);
 	} else if (shared_ptr <const Dynamic_Dep> dynamic_dep= to <Dynamic_Dep> (dep)) {
@@ -622,6 +624,7 @@ void Dep::normalize(shared_ptr <const Dep> dep,
 shared_ptr <Dep> Dep::clone(shared_ptr <const Dep> dep)
 {
 	assert(dep); 
+	Counters::add(Counters::C_DEP_CLONE); 
 
 	if (to <Plain_Dep> (dep)) {
 		return make_shared <Plain_Dep> (* to <Plain_Dep> (dep)); 
@@ -0,0 +1,324 @@
+#ifndef DIGEST_HH
+#define DIGEST_HH
+
+/*
+ * Rebuild decisions based on the content of files, used with the -H
+ * option.  By default, a file target is rebuilt when one of its
+ * dependencies is newer.  With -H, Stu records for each file target the
+ * digests of its content and of the content of its inputs, i.e., of all
+ * files whose timestamps are considered for it.  When the timestamps
+ * say that the target must be rebuilt, but the target and all its
+ * inputs still have their recorded digests, the target is considered
+ * up to date instead.  Thus, a touched file, or an intermediate file
+ * that was regenerated with identical content, does not cause its
+ * dependent targets to be rebuilt.
+ *
+ * Computing a digest means reading the whole file, and therefore
+ * digests are also stored per file together with the file's timestamp
+ * and size.  A file is only read again when these have changed.
+ *
+ * The digests are stored in a state file (see state.hh), whose fields
+ * are records of two kinds:
+ *
+ *    F FILENAME STATE DIGEST
+ *        The digest of a file, with STATE as in format_file_state()
+ *    R TARGET N (NAME DIGEST){N}
+ *        The digests of the target and of its inputs, when the target
+ *        was last built or found up to date
+ */
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "state.hh"
+
+class Digest
+{
+public:
+	static const char *filename;
+	/* Set by the -H option; null when not used */
+
+	static void read();
+	/* Read the state file, if it exists */
+
+	static void write();
+	/* Write the state file, if anything has changed */
+
+	static bool unchanged(const vector <Target> &targets,
+			      const set <string> &inputs);
+	/* Whether all file targets among TARGETS have a record, and
+	 * the targets and exactly the files in INPUTS still have the
+	 * recorded digests */
+
+	static void record(const vector <Target> &targets,
+			   const set <string> &inputs);
+	/* Record the current digests for all file targets among
+	 * TARGETS.  When a digest cannot be computed, e.g., because a
+	 * file does not exist or is not a regular file, the records of
+	 * the targets are removed.  */
+
+private:
+	struct File
+	{
+		string state;
+		uint64_t digest;
+
+		bool keep;
+		/* Whether to write the digest to the state file.  A
+		 * file whose timestamp is not older than Stu startup
+		 * could still be changed without its timestamp
+		 * changing, and therefore its digest is only used
+		 * during this invocation.  */
+	};
+
+	typedef vector <pair <string, uint64_t> > Record;
+	/* Sorted by name */
+
+	static const char *const header;
+
+	static unordered_map <string, File> files;
+	static unordered_map <string, Record> records;
+
+	static bool changed;
+	/* Whether FILES or RECORDS were changed since reading */
+
+	static bool get(const string &name, uint64_t &digest);
+	/* Get the current digest of the file, computing it when
+	 * needed.  Return false when it cannot be computed.  */
+
+	static bool get_record(const vector <Target> &targets,
+			       const set <string> &inputs,
+			       Record &record);
+	/* Compute the record of the given targets and inputs */
+
+	static bool compute(const char *name, uint64_t &digest);
+	/* Compute the digest of the content of a file */
+
+	static uint64_t hash(const char *p, size_t size);
+	/* A fast non-cryptographic hash function, processing eight
+	 * bytes at a time */
+};
+
+const char *Digest::filename= nullptr;
+const char *const Digest::header= "stu digests 1";
+unordered_map <string, Digest::File> Digest::files;
+unordered_map <string, Digest::Record> Digest::records;
+bool Digest::changed= false;
+
+void Digest::read()
+{
+	assert(filename);
+
+	vector <string> fields;
+	if (! read_state(filename, header, fields))
+		return;
+
+	for (size_t i= 0;  i < fields.size();) {
+		if (fields[i] == "F" && i + 4 <= fields.size()) {
+			File &file= files[fields[i + 1]];
+			file.state= fields[i + 2];
+			file.digest= strtoull(fields[i + 3].c_str(), nullptr, 16);
+			file.keep= true;
+			i += 4;
+		} else if (fields[i] == "R" && i + 3 <= fields.size()) {
+			size_t n= strtoul(fields[i + 2].c_str(), nullptr, 10);
+			if (n > (fields.size() - i - 3) / 2)
+				goto malformed;
+			Record &record= records[fields[i + 1]];
+			record.clear();
+			for (size_t j= 0;  j < n;  ++j)
+				record.emplace_back(fields[i + 3 + 2 * j],
+						    strtoull(fields[i + 4 + 2 * j].c_str(), nullptr, 16));
+			i += 3 + 2 * n;
+		} else {
+			goto malformed;
+		}
+	}
+	return;
+
+ malformed:
+	files.clear();
+	records.clear();
+}
+
+void Digest::write()
+{
+	assert(filename);
+
+	if (! changed)
+		return;
+
+	vector <string> fields;
+	for (const auto &i:  files) {
+		if (! i.second.keep)
+			continue;
+		fields.push_back("F");
+		fields.push_back(i.first);
+		fields.push_back(i.second.state);
+		fields.push_back(frmt("%016jx", (uintmax_t) i.second.digest));
+	}
+	for (const auto &i:  records) {
+		fields.push_back("R");
+		fields.push_back(i.first);
+		fields.push_back(frmt("%zu", i.second.size()));
+		for (const auto &j:  i.second) {
+			fields.push_back(j.first);
+			fields.push_back(frmt("%016jx", (uintmax_t) j.second));
+		}
+	}
+	write_state(filename, header, fields, 'H');
+}
+
+bool Digest::unchanged(const vector <Target> &targets,
+		       const set <string> &inputs)
+{
+	Record record;
+	if (! get_record(targets, inputs, record))
+		return false;
+
+	bool has_file= false;
+	for (const Target &target:  targets) {
+		if (! target.is_file())
+			continue;
+		has_file= true;
+		auto i= records.find(target.get_name_nondynamic());
+		if (i == records.end() || i->second != record)
+			return false;
+	}
+	return has_file;
+}
+
+void Digest::record(const vector <Target> &targets,
+		    const set <string> &inputs)
+{
+	Record record;
+	bool success= get_record(targets, inputs, record);
+
+	for (const Target &target:  targets) {
+		if (! target.is_file())
+			continue;
+		string name= target.get_name_nondynamic();
+		if (success) {
+			Record &record_old= records[name];
+			if (record_old != record) {
+				record_old= record;
+				changed= true;
+			}
+		} else if (records.erase(name)) {
+			changed= true;
+		}
+	}
+}
+
+bool Digest::get(const string &name, uint64_t &digest)
+{
+	struct stat buf;
+	if (Probe::stat(name.c_str(), &buf) != 0 || ! S_ISREG(buf.st_mode))
+		return false;
+
+	string state= format_file_state(&buf);
+	auto i= files.find(name);
+	if (i != files.end() && i->second.state == state) {
+		digest= i->second.digest;
+		return true;
+	}
+
+	if (! compute(name.c_str(), digest))
+		return false;
+
+	File &file= files[name];
+	file.state= state;
+	file.digest= digest;
+	file.keep= Timestamp(&buf) < Timestamp::startup;
+	changed= true;
+	return true;
+}
+
+bool Digest::get_record(const vector <Target> &targets,
+			const set <string> &inputs,
+			Record &record)
+{
+	set <string> names= inputs;
+	for (const Target &target:  targets) {
+		if (target.is_file())
+			names.insert(target.get_name_nondynamic());
+	}
+
+	for (const string &name:  names) {
+		uint64_t digest;
+		if (! get(name, digest))
+			return false;
+		record.emplace_back(name, digest);
+	}
+	return true;
+}
+
+bool Digest::compute(const char *name, uint64_t &digest)
+{
+	Counters::add(Counters::C_OPEN); 
+	int fd= open(name, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat buf;
+	if (fstat(fd, &buf) < 0) {
+		close(fd);
+		return false;
+	}
+
+	/* mmap() may fail on files of length zero */
+	if (buf.st_size == 0) {
+		close(fd);
+		digest= hash(nullptr, 0);
+		return true;
+	}
+
+	size_t size= buf.st_size;
+	void *in= mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (in != MAP_FAILED) {
+		digest= hash((const char *) in, size);
+		munmap(in, size);
+		close(fd);
+		return true;
+	}
+
+	/* Read the file when it cannot be mapped */
+	string content;
+	char mem[0x10000];
+	ssize_t len;
+	while ((len= ::read(fd, mem, sizeof(mem))) > 0)
+		content.append(mem, len);
+	if (close(fd) < 0 || len < 0)
+		return false;
+	digest= hash(content.c_str(), content.size());
+	return true;
+}
+
+uint64_t Digest::hash(const char *p, size_t size)
+{
+	const uint64_t m1= 0x87c37b91114253d5;
+	const uint64_t m2= 0x4cf5ad432745937f;
+	uint64_t h= 0x9e3779b97f4a7c15 ^ size;
+
+	for (size_t i= 0;  i < size;  i += 8) {
+		uint64_t w= 0;
+		memcpy(&w, p + i, size - i < 8 ? size - i : 8);
+		w *= m1;
+		w= (w << 31) | (w >> 33);
+		w *= m2;
+		h ^= w;
+		h= ((h << 27) | (h >> 37)) * 5 + 0x52dce729;
+	}
+
+	/* Final mixing */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccd;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53;
+	h ^= h >> 33;
+	return h;
+}
+
+#endif /* ! DIGEST_HH */
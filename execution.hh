@@ -34,6 +34,16 @@
 #include "tokenizer.hh"
 #include "rule.hh"
 #include "timestamp.hh"
+#include "probe.hh"
+#include "manifest.hh"
+#include "digest.hh"
+#include "history.hh"
+#include "memory.hh"
+#include "timeline.hh"
+#include "accounting.hh"
+#include "critical.hh"
+#include "progress.hh"
+#include "adapt.hh"
 
 typedef unsigned Proceed;
 /* This is used as the return value of the functions execute*() Defined
@@ -107,6 +117,22 @@ public:
 		/* At least one file target is known not to exist (only
 		 * possible if there is at least one file target in
 		 * File_Execution).  */
+
+		B_IDLE		= 1 << 4,
+		/* The execution is only waiting for jobs to finish, i.e.,
+		 * calling execute() again before any job has finished
+		 * would not do anything besides returning P_WAIT.  Set
+		 * only when all children also have the bit set, such
+		 * that parents can skip idle subtrees in
+		 * execute_children().  Cleared by wake().  Changed only
+		 * by set_idle() and wake(), which keep
+		 * COUNT_CHILDREN_AWAKE and CHILDREN_WOKEN of the parents
+		 * up to date.  */
+
+		B_PUSHED	= 1 << 5,
+		/* Dependencies were pushed to BUFFER_A since its files
+		 * were last probed and it was last sorted.  Otherwise,
+		 * this need not be done again.  */
 	};
 
 	void raise(int error_);
@@ -211,6 +237,28 @@ public:
 	/* Get the target value used for caching.  I.e, return TARGET
 	 * with certain flags removed.  */
 
+	static double get_priority(shared_ptr <const Dep> dep); 
+	/* The recorded length of the critical path of the normalized
+	 * dependency, or zero when not known */
+
+	static void invalidate(const vector <Target> &targets_invalid,
+			       bool keep_transients= false);
+	/* With -w, between builds:  delete the cached executions of the
+	 * given targets, and all cached executions that depend on them,
+	 * such that they are created anew by the next build.  Targets
+	 * without an execution are ignored.  With KEEP_TRANSIENTS, the
+	 * transients executed without error are still considered as
+	 * executed.  */
+
+	static void invalidate_stale();
+	/* With -w, after a build:  invalidate the executions that ran a
+	 * job or had an error, as they are not up to date anymore */
+
+	static void invalidate_all();
+	/* With -w, between builds:  delete all cached executions and
+	 * forget all executed transients.  Used when the rules have
+	 * changed.  */
+
 protected: 
 
 	Bits bits;
@@ -232,6 +280,18 @@ protected:
 	set <Execution *> children;
 	/* Currently connected executions */
 
+	size_t count_children_awake;
+	/* Number of executions in CHILDREN without the B_IDLE bit */
+
+	vector <Execution *> children_woken;
+	/* The children that execute_children() executes the next time,
+	 * i.e., all children in CHILDREN without the B_IDLE bit, and
+	 * those connected with a trivial or optional link.  May
+	 * contain duplicates, and executions that are not children
+	 * anymore; these are skipped.  This makes the work done after
+	 * a job has finished proportional to the number of executions
+	 * woken by it, instead of to the number of children.  */
+
 	Timestamp timestamp; 
 	/* Latest timestamp of a (direct or indirect) dependency
 	 * that was not rebuilt.  Files that were rebuilt are not
@@ -240,6 +300,28 @@ protected:
 	 * itself, if any.  This final timestamp is then carried over to the
 	 * parent executions.  */
 
+	set <string> inputs;
+	/* With the -H option:  the files whose timestamps were carried
+	 * over into TIMESTAMP, i.e., the direct and indirect file
+	 * dependencies.  Empty without -H.  */
+
+	double critical;
+	/* With the -T option:  the length in seconds of the longest
+	 * chain of recorded job durations through the children that were
+	 * disconnected so far, not including the job of this execution.
+	 * Zero without -T.  */
+
+	double priority;
+	/* With -m critical:  the recorded length of the critical path of
+	 * this execution.  Children with a higher value are executed
+	 * first.  Zero otherwise.  */
+
+	ssize_t job_last;
+	/* With -z:  the index in Critical of the job that finished last
+	 * among the children that were disconnected so far, or the job
+	 * of this execution once it has finished.  -1 when there is
+	 * none.  */
+
 	vector <shared_ptr <const Dep> > result; 
 	/* The final list of dependencies represented by the target.
 	 * This does not include any dynamic dependencies, i.e., all
@@ -262,11 +344,26 @@ protected:
 	 * used.  Null by default, and set by individual implementations
 	 * in their constructor if necessary.  */ 
 
+	vector <Target> targets_cached;
+	/* With -w:  the keys under which THIS is in
+	 * EXECUTIONS_BY_TARGET.  Empty without -w, and for executions
+	 * that are not cached.  */
+
+	unordered_set <Target> dependents;
+	/* With -w:  the keys of the cached executions that depend on
+	 * THIS, directly or via executions that are not cached.  Kept
+	 * after the links are removed.  Empty without -w.  */
+
 	Execution(shared_ptr <const Rule> param_rule_= nullptr)
 		:  bits(0),
 		   error(0),
+		   count_children_awake(0),
 		   timestamp(Timestamp::UNDEFINED),
-		   param_rule(param_rule_)
+		   critical(0),
+		   priority(0),
+		   job_last(-1),
+		   param_rule(param_rule_),
+		   mark_cycle(0)
 	{  }
 
 	Proceed execute_children();
@@ -286,11 +383,36 @@ protected:
 	const Buffer &get_buffer_A() const {  return buffer_A;  }
 	const Buffer &get_buffer_B() const {  return buffer_B;  }
 
+	void update_idle(Proceed proceed_execute);
+	/* Set or clear the B_IDLE bit, after execute() was called on
+	 * this execution and returned PROCEED_EXECUTE.  */
+
+	void set_idle();
+	/* Set the B_IDLE bit */
+
+	void wake();
+	/* Clear the B_IDLE bit of this execution and of all its
+	 * ancestors, and add them to CHILDREN_WOKEN of their parents.
+	 * Called when something may have changed for this execution
+	 * outside of a call to execute(), i.e., when a job has
+	 * finished.  */
+
+	void insert_child(Execution *child);
+	void erase_child(Execution *child);
+	/* Add and remove CHILD to and from CHILDREN */
+
+	virtual bool running_job() const {  return false;  }
+	/* Whether the execution itself is waiting for a running job */
+
 	void push(shared_ptr <const Dep> dep);
 	/* Push a dependency to the default buffer, breaking down
 	 * non-normalized dependencies while doing so.  DEP does not
 	 * have to be normalized.  */
 
+	void probe_buffer_A() const;
+	/* Probe all files in BUFFER_A for which no execution exists yet
+	 * at once, before they are connected one by one.  */
+
 	void push_result(shared_ptr <const Dep> dd); 
 	void disconnect(Execution *const child,
 			shared_ptr <const Dep> dep_child);
@@ -334,7 +456,22 @@ protected:
 
 	static unordered_map <Target, Execution *> executions_by_target;
 	/* All cached Execution objects by each of their Target.  Such
-	 * Execution objects are never deleted.  */
+	 * Execution objects are only deleted in watch mode, between
+	 * builds.  */
+
+	static vector <Target> targets_stale;
+	/* With -w:  the keys of the executions that must be invalidated
+	 * after the current build, possibly with duplicates */
+
+	void cache(const Target &target);
+	/* Insert THIS into EXECUTIONS_BY_TARGET under TARGET */
+
+	void link_dependent(Execution *child);
+	/* With -w, record THIS as a dependent of CHILD */
+
+	void set_stale();
+	/* With -w, invalidate THIS after the current build, or the
+	 * cached executions depending on it when it is not cached */
 
 	static bool find_cycle(Execution *parent,
 			       Execution *child,
@@ -351,7 +488,8 @@ protected:
 			       shared_ptr <const Dep> dep_link); 
 	/* Helper function.  PATH is the currently explored path.
 	 * PATH[0] is the original PARENT; PATH[end] is the oldest
-	 * grandparent found yet.  */ 
+	 * grandparent found yet.  Each execution is explored at most
+	 * once per search.  */ 
 
 	static void cycle_print(const vector <Execution *> &path,
 				shared_ptr <const Dep> dep);
@@ -389,6 +527,14 @@ private:
 	 * dependencies, the target must be rebuilt anyway.  Does not
 	 * contain compound dependencies.  */
 
+	unsigned long mark_cycle;
+	/* Equal to COUNTER_CYCLE when this execution was already
+	 * visited by the current call to find_cycle() */
+
+	static unsigned long counter_cycle;
+	/* Incremented on each call to find_cycle(), so that the marks
+	 * of previous searches need not be reset */
+
 	Proceed connect(shared_ptr <const Dep> dep_this,
 			shared_ptr <const Dep> dep_child);
 	/* Add an edge to the dependency graph.  Deploy a new child
@@ -483,16 +629,24 @@ public:
 	}
 
 	static size_t executions_by_pid_size;
+	static size_t executions_by_pid_mask; 
 	static pid_t *executions_by_pid_key;
 	static File_Execution **executions_by_pid_value; 
 	/* The currently running executions by process IDs.  Write
 	 * access to this is enclosed in a Signal_Blocker.  */
-	/* Both arrays are malloc'ed, have the same length, and are both
-	 * sorted by PID.  malloc() is only called once for each array,
-	 * giving the allocated memory a length that will be enough for
-	 * all jobs we will ever run, based on the value passed via the
-	 * -j option, so we avoid excessive calling of realloc(), and
-	 * race conditions while accessing this.  */
+	/* A hash table with open addressing and linear probing:  Both
+	 * arrays are malloc'ed and have the same length, which is a
+	 * power of two equal to EXECUTIONS_BY_PID_MASK + 1.  The slot
+	 * of a PID is found by starting at PID & EXECUTIONS_BY_PID_MASK;
+	 * consecutive PIDs thus go into consecutive slots.  Unused
+	 * slots have the key 0.  EXECUTIONS_BY_PID_SIZE is the number of
+	 * used slots.  malloc() is only called once for each array,
+	 * giving the allocated memory a length of at least twice the
+	 * number of jobs we will ever run, based on the value passed
+	 * via the -j option, so we avoid excessive calling of
+	 * realloc(), and race conditions while accessing this.  To
+	 * iterate over all executions, e.g., in async signal-safe
+	 * functions, all slots are visited.  */
 	/* For all file executions stored here, the following variables
 	 * are never changed as long as the File_Execution objects are
 	 * stored there, such that they can be accessed from
@@ -500,13 +654,14 @@ public:
 	 * 	FILENAMES, TIMESTAMPS_OLD    */
 
 	static void wait();
-	/* Wait for next job to finish and finish it.  Do not start anything
-	 * new.  */ 
+	/* Wait for next job to finish and finish it, as well as all other
+	 * jobs that have finished by then.  Do not start anything new.  */ 
 
 protected:
 
 	virtual bool optional_finished(shared_ptr <const Dep> dep_link);
 	virtual int get_depth() const {  return 0;  }
+	virtual bool running_job() const {  return job.started();  }
 
 private:
 
@@ -557,6 +712,26 @@ private:
 	Job job;
 	/* The job used to execute this rule's command */ 
 
+	double time_pool_refused;
+	/* When the job was first refused a slot of its pool, as
+	 * returned by Job::get_time(); negative when it was not refused
+	 * or has since acquired a slot */
+
+	double time_memory_refused;
+	/* Likewise for the memory budget */
+
+	long rss_reserved;
+	/* The memory reserved for the running job in the memory budget,
+	 * in kilobytes */
+
+	size_t timeline_lane;
+	/* The lane of the running job in the timeline; only used with -R */
+
+	double duration_pending;
+	/* With -G or -S:  the recorded duration of the job, or zero,
+	 * while the execution may still have to start its job and is
+	 * counted as pending in Progress.  Negative otherwise.  */
+
 	map <string, string> mapping_parameter; 
 	/* Variable assignments from parameters for when the command is run */
 
@@ -584,6 +759,23 @@ private:
 	 * for checking that it is correct.  INDEX is the index within
 	 * EXECUTIONS_BY_PID_*.  */
 
+	void leave_pending();
+	/* No longer count the execution as pending in Progress */
+
+	static void update_progress();
+	/* Pass the running jobs to Progress::update() */
+
+	static void waited_pid(pid_t pid, int status); 
+	/* Find the execution of the job with the given PID, which was
+	 * waited for, and call waited() on it */
+
+	static size_t insert_pid(pid_t pid, File_Execution *execution); 
+	/* Insert into EXECUTIONS_BY_PID_*, and return the slot.  The
+	 * caller must block signals using a Signal_Blocker.  */
+
+	static void remove_pid(size_t index); 
+	/* Remove the given slot from EXECUTIONS_BY_PID_* */ 
+
 	void warn_future_file(struct stat *buf, 
 			      const char *filename,
 			      const Place &place,
@@ -843,12 +1035,15 @@ private:
 
 long Execution::jobs= 1;
 Rule_Set Execution::rule_set; 
+unsigned long Execution::counter_cycle= 0;
 Timestamp Execution::timestamp_last;
 bool Execution::hide_out_message= false;
 bool Execution::out_message_done= false;
 unordered_map <Target, Execution *> Execution::executions_by_target;
+vector <Target> Execution::targets_stale;
 
 size_t File_Execution::executions_by_pid_size= 0;
+size_t File_Execution::executions_by_pid_mask= 0;
 pid_t *File_Execution::executions_by_pid_key= nullptr;
 File_Execution **File_Execution::executions_by_pid_value= nullptr; 
 unordered_map <string, Timestamp> File_Execution::transients;
@@ -864,7 +1059,15 @@ Execution::~Execution()
 void Execution::main(const vector <shared_ptr <const Dep> > &deps)
 {
 	assert(jobs >= 0);
+	if (Critical::enabled())
+		Critical::init(jobs); 
+	if (Progress::enabled())
+		Progress::init(jobs); 
+	if (Adapt::jobs_min)
+		Adapt::init(jobs); 
 	timestamp_last= Timestamp::now(); 
+	hide_out_message= false;
+	out_message_done= false; 
 	Root_Execution *root_execution= new Root_Execution(deps); 
 	int error= 0; 
 	shared_ptr <const Root_Dep> dep_root= make_shared <Root_Dep> (); 
@@ -874,11 +1077,15 @@ void Execution::main(const vector <shared_ptr <const Dep> > &deps)
 			Proceed proceed;
 			do {
 				Debug::print(nullptr, "loop"); 
+				Counters::add(Counters::C_LOOP); 
+				Counters::Timing timing(Counters::T_EXECUTE); 
 				proceed= root_execution->execute(dep_root);
 				assert(proceed); 
 			} while (proceed & P_PENDING); 
 
 			if (proceed & P_WAIT) {
+				Counters::add(Counters::C_WAIT); 
+				Counters::Timing timing(Counters::T_WAIT); 
 				File_Execution::wait();
 			}
 		}
@@ -899,6 +1106,10 @@ void Execution::main(const vector <shared_ptr <const Dep> > &deps)
 				else 
 					print_out("Targets are up to date");
 			}
+			/* Only a null build is recorded in the manifest,
+			 * as only its output is known in advance */
+			if (Manifest::filename && ! hide_out_message && ! out_message_done)
+				Manifest::write(); 
 		} else {
 			if (option_keep_going) {
 				print_error_reminder("Targets not up to date because of errors");
@@ -920,6 +1131,14 @@ void Execution::main(const vector <shared_ptr <const Dep> > &deps)
 		error= e; 
 	}
 
+	/* In watch mode, the cached executions are used again by the
+	 * next build.  Since -k is implied, all of them were
+	 * disconnected from the root.  */
+	if (option_watch) {
+		assert(root_execution->children.empty()); 
+		delete root_execution; 
+	}
+
 	if (error)
 		throw error; 
 }
@@ -929,6 +1148,7 @@ void Execution::read_dynamic(shared_ptr <const Plain_Dep> dep_target,
 			     shared_ptr <const Dep> dep,
 			     Execution *dynamic_execution)
 {
+	Timeline::Span span("read dynamic dependencies"); 
 	try {
 		const Place_Param_Target &place_param_target= to <Plain_Dep> (dep_target)->place_param_target; 
 
@@ -1070,6 +1290,13 @@ bool Execution::find_cycle(Execution *parent,
 			   Execution *child,
 			   shared_ptr <const Dep> dep_link)
 {
+	/* Only executions with a rule can be part of a cycle on the
+	 * rule level */
+	if (child->param_rule == nullptr)
+		return false;
+
+	Counters::Timing timing(Counters::T_CYCLE); 
+	++counter_cycle;
 	vector <Execution *> path;
 	path.push_back(parent); 
 	return find_cycle(path, child, dep_link); 
@@ -1078,7 +1305,20 @@ bool Execution::find_cycle(Execution *parent,
 bool Execution::find_cycle(vector <Execution *> &path,
 			   Execution *child,
 			   shared_ptr <const Dep> dep_link)
+/* 
+ * An execution that was already explored during the current search
+ * did not lead to CHILD, and therefore it is not explored a second
+ * time.  This makes the search linear in the number of ancestors
+ * instead of in the number of paths to them, which is exponential in
+ * graphs with many diamonds.  The found cycle is the same as if all
+ * paths were explored.  
+ */
 {
+	if (path.back()->mark_cycle == counter_cycle)
+		return false;
+	path.back()->mark_cycle= counter_cycle;
+	Counters::add(Counters::C_CYCLE_NODES); 
+
 	if (same_rule(path.back(), child)) {
 		cycle_print(path, dep_link); 
 		return true; 
@@ -1166,7 +1406,7 @@ void Execution::cycle_print(const vector <Execution *> &path,
 	 * two.  The offending link is from path[0] as a parent to
 	 * path[end] (as a child).  */
 	path.back()->parents.erase(path.at(0)); 
-	path.at(0)->children.erase(path.back()); 
+	path.at(0)->erase_child(path.back()); 
 
 	(*path.back()) << "";
 
@@ -1267,11 +1507,28 @@ void Execution::operator<<(string text) const
 
 Proceed Execution::execute_children()
 {
-	/* Since disconnect() may change execution->children, we must first
-	 * copy it over locally, and then iterate through it */ 
-
-	vector <Execution *> executions_children_vector
-		(children.begin(), children.end()); 
+	/* Only the woken children are executed; all others are idle.
+	 * Since disconnect() and wake() may change CHILDREN and
+	 * CHILDREN_WOKEN, we must first move the list over locally, and
+	 * then iterate through it.  Sorting it gives the same order as
+	 * that of CHILDREN, and removes duplicates.  */ 
+
+	vector <Execution *> executions_children_vector;
+	executions_children_vector.swap(children_woken); 
+	sort(executions_children_vector.begin(), executions_children_vector.end()); 
+	executions_children_vector.erase
+		(unique(executions_children_vector.begin(),
+			executions_children_vector.end()),
+		 executions_children_vector.end()); 
+
+	/* Children are taken from the end of the vector */ 
+	if (order == Order::CRITICAL) {
+		stable_sort(executions_children_vector.begin(),
+			    executions_children_vector.end(),
+			    [](const Execution *a, const Execution *b) {
+				    return a->priority < b->priority; 
+			    }); 
+	}
 
 	Proceed proceed_all= 0;
 
@@ -1295,10 +1552,31 @@ Proceed Execution::execute_children()
 		
 		assert(child != nullptr);
 
+		/* The child was disconnected since it was woken.  It may
+		 * have been deleted, and therefore must not be
+		 * dereferenced.  */
+		if (! children.count(child))
+			continue; 
+
+		Counters::add(Counters::C_EXECUTE_CHILD); 
+
 		shared_ptr <const Dep> dep_child= child->parents.at(this);
 
+		/* Don't descend into a subtree that is only waiting for
+		 * running jobs; the child would only return P_WAIT.
+		 * Trivial and optional links are always executed,
+		 * because their result depends on the link.  */
+		if (child->bits & B_IDLE
+		    && ! (dep_child->flags & (F_TRIVIAL | F_OPTIONAL))
+		    && ! child->finished(dep_child->flags)) {
+			Debug::print(child, "skip idle"); 
+			proceed_all |= P_WAIT;
+			continue;
+		}
+
 		Proceed proceed_child= child->execute(dep_child);
 		assert(proceed_child); 
+		child->update_idle(proceed_child); 
 
 		proceed_all |= (proceed_child & ~(P_FINISHED | P_ABORT));
 		/* The finished and abort flags of the child only apply to the
@@ -1314,9 +1592,17 @@ Proceed Execution::execute_children()
 			/* If the child execution is not finished, it
 			 * must have returned either the P_WAIT or
 			 * P_PENDING bit.  */
+			if (! (child->bits & B_IDLE) 
+			    || dep_child->flags & (F_TRIVIAL | F_OPTIONAL))
+				children_woken.push_back(child); 
 		}
 	}
 
+	/* The idle children that were not executed would have returned
+	 * P_WAIT */ 
+	if (count_children_awake < children.size())
+		proceed_all |= P_WAIT; 
+
 	if (error) {
 		assert(option_keep_going); 
 		/* Otherwise, Stu would have aborted */ 
@@ -1354,7 +1640,32 @@ void Execution::push(shared_ptr <const Dep> dep)
 		d->check(); 
 		assert(d->is_normalized()); 
 		buffer_A.push(d);
+		bits |= B_PUSHED; 
+	}
+}
+
+void Execution::probe_buffer_A() const
+{
+	if (buffer_A.size() < 2)
+		return;
+
+	vector <shared_ptr <const Dep> > deps;
+	buffer_A.get_all(deps); 
+
+	vector <string> filenames;
+	for (const auto &dep:  deps) {
+		if (! to <const Plain_Dep> (dep))
+			continue;
+		Target target= dep->get_target();
+		if (! target.is_file())
+			continue;
+		if (executions_by_target.count(get_target_for_cache(target)))
+			continue;
+		filenames.push_back(target.get_name_nondynamic()); 
 	}
+
+	Timeline::Span span("stat sweep"); 
+	Probe::probe(filenames); 
 }
 
 Proceed Execution::execute_base_A(shared_ptr <const Dep> dep_this)
@@ -1407,6 +1718,19 @@ Proceed Execution::execute_base_A(shared_ptr <const Dep> dep_this)
 		return proceed |= P_WAIT;
 	}
 
+	/* The files are probed and the buffer is sorted once for all
+	 * dependencies pushed so far, not each time the execution is
+	 * executed.  The buffer stays sorted when dependencies are
+	 * taken from it.  */
+	if (bits & B_PUSHED) {
+		bits &= ~B_PUSHED; 
+		probe_buffer_A(); 
+		if (order == Order::CRITICAL) 
+			buffer_A.sort([](shared_ptr <const Dep> d) {
+					return get_priority(d);
+				}); 
+	}
+
 	while (! buffer_A.empty()) {
 		shared_ptr <const Dep> dep_child= buffer_A.next(); 
 		if ((dep_child->flags & (F_RESULT_NOTIFY | F_TRIVIAL)) == F_TRIVIAL) {
@@ -1519,7 +1843,10 @@ Proceed Execution::connect(shared_ptr <const Dep> dep_this,
 		return 0;
 	}
 
-	children.insert(child);
+	insert_child(child);
+
+	if (order == Order::CRITICAL) 
+		child->priority= max(child->priority, get_priority(dep_child)); 
 
 	if (dep_child->flags & F_RESULT_NOTIFY) {
 		for (const auto &dependency:  child->result) {
@@ -1529,6 +1856,7 @@ Proceed Execution::connect(shared_ptr <const Dep> dep_this,
 
 	Proceed proceed_child= child->execute(dep_child);
 	assert(proceed_child); 
+	child->update_idle(proceed_child); 
 	if (proceed_child & (P_WAIT | P_PENDING))
 		return proceed_child; 
 			
@@ -1539,10 +1867,76 @@ Proceed Execution::connect(shared_ptr <const Dep> dep_this,
 	return 0;
 }
 
+void Execution::update_idle(Proceed proceed_execute)
+{
+	assert(count_children_awake <= children.size()); 
+	bool idle= proceed_execute == P_WAIT
+		&& buffer_A.empty() && buffer_B.empty()
+		&& (children.empty() ? running_job() : count_children_awake == 0); 
+
+	if (idle) 
+		set_idle(); 
+	else 
+		wake(); 
+}
+
+void Execution::set_idle()
+{
+	if (bits & B_IDLE)
+		return;
+
+	Debug::print(this, "idle"); 
+	bits |= B_IDLE;
+	/* PARENTS may contain executions that are not connected yet */ 
+	for (auto &i:  parents) {
+		Execution *parent= i.first; 
+		if (parent->children.count(this)) {
+			assert(parent->count_children_awake > 0); 
+			--parent->count_children_awake; 
+		}
+	}
+}
+
+void Execution::wake()
+{
+	/* When this execution is not idle, none of its ancestors are */ 
+	if (! (bits & B_IDLE))
+		return;
+
+	Debug::print(this, "wake"); 
+	bits &= ~B_IDLE;
+	for (auto &i:  parents) {
+		Execution *parent= i.first; 
+		if (parent->children.count(this)) {
+			++parent->count_children_awake; 
+			parent->children_woken.push_back(this); 
+		}
+		parent->wake(); 
+	}
+}
+
+void Execution::insert_child(Execution *child)
+{
+	if (children.insert(child).second && ! (child->bits & B_IDLE))
+		++count_children_awake; 
+	/* Also when it is idle, because the link may be trivial or
+	 * optional */
+	children_woken.push_back(child); 
+}
+
+void Execution::erase_child(Execution *child)
+{
+	if (children.erase(child) && ! (child->bits & B_IDLE)) {
+		assert(count_children_awake > 0); 
+		--count_children_awake; 
+	}
+}
+
 void Execution::raise(int error_)
 {
 	assert(error_ >= 1 && error_ <= 3); 
 	error |= error_;
+	set_stale(); 
 	if (! option_keep_going)
 		throw error;
 }
@@ -1582,9 +1976,42 @@ void Execution::disconnect(Execution *const child,
 			} else if (timestamp < child->timestamp) {
 				timestamp= child->timestamp; 
 			}
+
+			/* Propagate the corresponding inputs */ 
+			if (Digest::filename) {
+				if (to <const Plain_Dep> (dep_child) 
+				    && dep_child->get_target().is_file()) 
+					inputs.insert(dep_child->get_target().get_name_nondynamic()); 
+				else
+					inputs.insert(child->inputs.begin(), child->inputs.end()); 
+			}
+		}
+	}
+
+	/* Propagate the critical path */ 
+	if (History::filename) {
+		double critical_child= child->critical; 
+		if (to <const Plain_Dep> (dep_child) || to <const Dynamic_Dep> (dep_child)) {
+			Target target= dep_child->get_target(); 
+			critical_child += History::get_duration(target); 
+			History::set_critical(target, critical_child); 
 		}
+		if (critical < critical_child)
+			critical= critical_child; 
 	}
 
+	if (Progress::enabled()) {
+		File_Execution *file_execution= dynamic_cast <File_Execution *> (child); 
+		if (file_execution)
+			file_execution->leave_pending(); 
+	}
+
+	/* Propagate the job that finished last */
+	if (child->job_last >= 0 &&
+	    (job_last < 0 || Critical::get_time_end(child->job_last)
+	     > Critical::get_time_end(job_last)))
+		job_last= child->job_last;
+
 	/* Propagate variables */
 	if ((dep_child->flags & F_VARIABLE)) { 
 		assert(dynamic_cast <File_Execution *> (child)); 
@@ -1603,6 +2030,8 @@ void Execution::disconnect(Execution *const child,
 	 * before.  */ 
 
 	error |= child->error; 
+	if (child->error)
+		set_stale(); 
 
 	/* Don't propagate the NEED_BUILD flag via DYNAMIC_LEFT links:
 	 * It just means the list of depenencies have changed, not the
@@ -1615,7 +2044,7 @@ void Execution::disconnect(Execution *const child,
 	/* Remove the links between them */ 
 	assert(children.count(child) == 1); 
 	assert(child->parents.count(this) == 1);
-	children.erase(child);
+	erase_child(child);
 	child->parents.erase(this);
 
 	/* Delete the Execution object */
@@ -1653,10 +2082,12 @@ Execution *Execution::get_execution(shared_ptr <const Dep> dep)
 		assert(execution); 
 		if (error_additional) {
 			error |= error_additional; 
+			set_stale(); 
 			assert(execution->want_delete());
 			delete execution; 
 			return nullptr; 
 		}
+		link_dependent(execution); 
 		return execution;
 	}
 
@@ -1668,10 +2099,12 @@ Execution *Execution::get_execution(shared_ptr <const Dep> dep)
 		assert(execution);
 		if (error_additional) {
 			error |= error_additional;
+			set_stale(); 
 			assert(execution->want_delete()); 
 			delete execution;
 			return nullptr; 
 		}
+		link_dependent(execution); 
 		return execution; 
 	}
 
@@ -1690,6 +2123,7 @@ Execution *Execution::get_execution(shared_ptr <const Dep> dep)
 	if (it != executions_by_target.end()) {
 		/* An Execution object already exists for the target */ 
 		execution= it->second; 
+		link_dependent(execution); 
 		if (execution->parents.count(this)) {
 			/* THIS and CHILD are already connected -- add the
 			 * necessary flags */ 
@@ -1727,6 +2161,7 @@ Execution *Execution::get_execution(shared_ptr <const Dep> dep)
 		map <string, string> mapping_parameter;
 		bool use_file_execution= false;
 		try {
+			Timeline::Span span("rule lookup"); 
 			Target target_without_flags= target; 
 			target_without_flags.get_front_word_nondynamic() &= F_TARGET_TRANSIENT; 
 			rule_child= rule_set.get(target_without_flags, 
@@ -1783,12 +2218,16 @@ Execution *Execution::get_execution(shared_ptr <const Dep> dep)
 
 	if (error_additional) {
 		error |= error_additional; 
+		set_stale(); 
 		if (execution->want_delete())
 			delete execution; 
+		else
+			link_dependent(execution); 
 		return nullptr; 
 	}
 	
 	assert(execution->parents.size() == 1); 
+	link_dependent(execution); 
 
 	return execution;
 }
@@ -1839,6 +2278,105 @@ Target Execution::get_target_for_cache(Target target)
 	return target; 
 }
 
+double Execution::get_priority(shared_ptr <const Dep> dep)
+{
+	if (! to <const Plain_Dep> (dep) && ! to <const Dynamic_Dep> (dep))
+		return 0; 
+	return History::get_critical(dep->get_target()); 
+}
+
+void Execution::invalidate(const vector <Target> &targets_invalid,
+			   bool keep_transients)
+{
+	/* Collect the executions, and all that depend on them */
+	unordered_set <Execution *> executions;
+	vector <Execution *> executions_todo;
+	for (const Target &target:  targets_invalid) {
+		auto i= executions_by_target.find(target);
+		if (i != executions_by_target.end() && executions.insert(i->second).second)
+			executions_todo.push_back(i->second);
+	}
+	while (! executions_todo.empty()) {
+		Execution *execution= executions_todo.back();
+		executions_todo.pop_back();
+		for (const Target &target:  execution->dependents) {
+			auto i= executions_by_target.find(target);
+			if (i != executions_by_target.end() && executions.insert(i->second).second)
+				executions_todo.push_back(i->second);
+		}
+	}
+
+	for (Execution *execution:  executions) {
+		Debug::print(execution, "invalidate");
+		/* An execution that could not be connected because of an
+		 * error may still refer to the parent */
+		assert(execution->error || execution->parents.empty());
+		assert(execution->children.empty());
+		for (const Target &target:  execution->targets_cached) {
+			auto i= executions_by_target.find(target);
+			if (i != executions_by_target.end() && i->second == execution)
+				executions_by_target.erase(i);
+		}
+		File_Execution *file_execution= dynamic_cast <File_Execution *> (execution);
+		if (file_execution && ! (keep_transients && execution->error == 0)) {
+			for (const Target &target:  file_execution->targets) {
+				if (target.is_transient())
+					File_Execution::transients.erase(target.get_name_nondynamic());
+			}
+		}
+		delete execution;
+	}
+}
+
+void Execution::invalidate_stale()
+{
+	vector <Target> targets_invalid;
+	swap(targets_invalid, targets_stale);
+	invalidate(targets_invalid, true);
+}
+
+void Execution::invalidate_all()
+{
+	unordered_set <Execution *> executions;
+	for (const auto &i:  executions_by_target)
+		executions.insert(i.second);
+	for (Execution *execution:  executions) {
+		assert(execution->error || execution->parents.empty());
+		assert(execution->children.empty());
+		delete execution;
+	}
+	executions_by_target.clear();
+	File_Execution::transients.clear();
+	targets_stale.clear();
+}
+
+void Execution::cache(const Target &target)
+{
+	executions_by_target[target]= this;
+	if (option_watch)
+		targets_cached.push_back(target);
+}
+
+void Execution::link_dependent(Execution *child)
+{
+	if (! option_watch)
+		return;
+	if (targets_cached.empty())
+		child->dependents.insert(dependents.begin(), dependents.end());
+	else
+		child->dependents.insert(targets_cached.front());
+}
+
+void Execution::set_stale()
+{
+	if (! option_watch)
+		return;
+	if (targets_cached.empty())
+		targets_stale.insert(targets_stale.end(), dependents.begin(), dependents.end());
+	else
+		targets_stale.push_back(targets_cached.front());
+}
+
 shared_ptr <const Dep> Execution::append_top(shared_ptr <const Dep> dep, 
 					     shared_ptr <const Dep> top)
 {
@@ -1872,11 +2410,9 @@ shared_ptr <const Dep> Execution::set_top(shared_ptr <const Dep> dep,
 }
 
 File_Execution::~File_Execution()
-/* Objects of this type are never deleted */ 
+/* Objects of this type are only deleted in watch mode */ 
 {
-	assert(false);
-
-	/* We write this here as a reminder if this is ever activated */
+	assert(! job.started()); 
 
 	free(timestamps_old); 
 	if (filenames) {
@@ -1890,59 +2426,130 @@ File_Execution::~File_Execution()
 }
 
 void File_Execution::wait() 
-/* We wait for a single job to finish, and then return so that the next
- * job can be started.  It would also be possible to process as many
- * finished jobs as possible, and then return, but the current
- * implementation prefers to first start the next job before waiting for
- * the next finished job.  */
+/* We wait for a job to finish, and then also finish all other jobs that
+ * have finished by then, before returning so that the next jobs can be
+ * started.  When many short jobs run in parallel, this avoids going
+ * through the whole dependency graph once for each finished job.  */
 {
 	Debug::print(nullptr, "wait...");
 
 	assert(File_Execution::executions_by_pid_size); 
 
 	int status;
-	const pid_t pid= Job::wait(&status); 
+	pid_t pid= Job::wait(&status, true); 
+	/* Zero when woken up by the timeout of adaptive mode */
 
-	Debug::print(nullptr, frmt("pid = %ld", (long) pid)); 
+	while (pid > 0) {
+		Debug::print(nullptr, frmt("pid = %ld", (long) pid)); 
+		timestamp_last= Timestamp::now(); 
+		waited_pid(pid, status); 
+		if (! executions_by_pid_size)
+			break;
+		pid= Job::wait(&status, false); 
+	}
 
-	timestamp_last= Timestamp::now(); 
+	string text= Adapt::update(jobs);
+	if (! text.empty())
+		Debug::print(nullptr, text); 
+}
 
-	size_t mi= 0, ma= executions_by_pid_size - 1;
-	/* Both are inclusive */
-	assert(mi <= ma); 
-	while (mi < ma) {
-		size_t ne= mi + (ma - mi + 1) / 2;
-		assert(ne <= ma); 
-		if (executions_by_pid_key[ne] == pid) {
-			mi= ma= ne; 
-			break;
-		}
-		if (executions_by_pid_key[ne] < pid) {
-			mi= ne + 1;
-		} else {
-			ma= ne - 1;
+void File_Execution::waited_pid(pid_t pid, int status)
+{
+	size_t index= pid & executions_by_pid_mask; 
+	while (executions_by_pid_key[index] != pid) {
+		if (executions_by_pid_key[index] == 0) {
+			/* No File_Execution is registered for the PID
+			 * that just finished.  Should not happen, but
+			 * since the PID value came from outside this
+			 * process, we better handle this case
+			 * gracefully, i.e., do nothing.  */
+			print_warning(Place(), 
+				      frmt("The function waitpid(2) returned the invalid process ID %jd", 
+					   (intmax_t)pid)); 
+			return; 
 		}
+		index= (index + 1) & executions_by_pid_mask; 
 	}
-	if (mi > ma || mi == SIZE_MAX) {
-		/* No File_Execution is registered for the PID that
-		 * just finished.  Should not happen, but since the PID
-		 * value came from outside this process, we better
-		 * handle this case gracefully, i.e., do nothing.  */
-		print_warning(Place(), 
-			      frmt("The function waitpid(2) returned the invalid process ID %jd", 
-				   (intmax_t)pid)); 
-		return; 
-	}
-	assert(mi == ma); 
-	const size_t index= mi; 
-	assert(index < executions_by_pid_size); 
-	assert(executions_by_pid_key[index] == pid); 
 	
 	File_Execution *const execution= executions_by_pid_value[index]; 
+	execution->wake(); 
 	execution->waited(pid, index, status); 
 	++jobs; 
 }
 
+size_t File_Execution::insert_pid(pid_t pid, File_Execution *execution)
+{
+	assert(pid > 0); 
+	assert(!executions_by_pid_key == !executions_by_pid_value);
+
+	if (!executions_by_pid_key) {
+		/* This is executed just once, before we have executed
+		 * any job, and therefore JOBS is the value passed via -j
+		 * (or its default value 1), and thus we can allocate
+		 * arrays of that size once and for all.  In adaptive
+		 * mode, JOBS is the initial limit, and the value of -j
+		 * is used instead.  The table is kept at most half
+		 * full.  */
+		long jobs_max= Adapt::jobs_min ? Adapt::get_jobs_max() : jobs; 
+		size_t size= 2;
+		while (size < 2 * (size_t) jobs_max) {
+			if (size > SIZE_MAX / sizeof(*executions_by_pid_value) / 2) {
+				errno= ENOMEM;
+				perror("malloc"); 
+				exit(ERROR_FATAL); 
+			}
+			size *= 2; 
+		}
+		executions_by_pid_key  = (pid_t *)          calloc(size, sizeof(*executions_by_pid_key));
+		executions_by_pid_value= (File_Execution **)calloc(size, sizeof(*executions_by_pid_value)); 
+		if (!executions_by_pid_key || !executions_by_pid_value) {
+			perror("calloc"); 
+			exit(ERROR_FATAL); 
+		}
+		executions_by_pid_mask= size - 1; 
+	}
+	assert(executions_by_pid_size < executions_by_pid_mask); 
+
+	size_t index= pid & executions_by_pid_mask; 
+	while (executions_by_pid_key[index] != 0) {
+		assert(executions_by_pid_key[index] != pid); 
+		index= (index + 1) & executions_by_pid_mask; 
+	}
+	executions_by_pid_key[index]= pid;
+	executions_by_pid_value[index]= execution;
+	++ executions_by_pid_size; 
+	return index; 
+}
+
+void File_Execution::remove_pid(size_t index)
+/* Entries after the removed one are moved back into the gap when their
+ * own slot does not lie cyclically after the gap, such that lookups
+ * never have to skip over removed entries.  */
+{
+	assert(executions_by_pid_size > 0); 
+	assert(executions_by_pid_key[index] != 0); 
+
+	Job::Signal_Blocker sb;
+	size_t i= index;
+	size_t j= index; 
+	while (true) {
+		j= (j + 1) & executions_by_pid_mask; 
+		if (executions_by_pid_key[j] == 0)
+			break;
+		size_t k= executions_by_pid_key[j] & executions_by_pid_mask; 
+		/* Whether K is cyclically within (I, J] */ 
+		bool stays= i <= j ? (i < k && k <= j) : (i < k || k <= j); 
+		if (! stays) {
+			executions_by_pid_key[i]= executions_by_pid_key[j]; 
+			executions_by_pid_value[i]= executions_by_pid_value[j]; 
+			i= j; 
+		}
+	}
+	executions_by_pid_key[i]= 0;
+	executions_by_pid_value[i]= nullptr; 
+	-- executions_by_pid_size; 
+}
+
 void File_Execution::waited(pid_t pid, size_t index, int status) 
 {
 	assert(job.started()); 
@@ -1952,31 +2559,64 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 
 	done= ~0;
 
-	{
-		Job::Signal_Blocker sb;
-		/* Remove entry from EXECUTIONS_BY_PID_* */
-		assert(executions_by_pid_size > 0); 
-		assert(executions_by_pid_size >= index + 1); 
-		memmove(executions_by_pid_key + index,
-			executions_by_pid_key + index + 1,
-			sizeof(*executions_by_pid_key) * (executions_by_pid_size - index - 1)); 
-		memmove(executions_by_pid_value + index,
-			executions_by_pid_value + index + 1,
-			sizeof(*executions_by_pid_value) * (executions_by_pid_size - index - 1)); 
-		-- executions_by_pid_size; 
+	assert(executions_by_pid_key[index] == pid); 
+	remove_pid(index); 
+
+	if (rule->pool)
+		rule->pool->release(); 
+	if (rss_reserved) {
+		Memory::release(rss_reserved); 
+		rss_reserved= 0; 
 	}
 
 	/* The file(s) may have been built, so forget that it was known
 	 * to not exist */
 	bits &= ~B_MISSING; 
 
-	if (job.waited(status, pid)) {
+	/* The command may have changed its file targets, and may have
+	 * created files declared without a command */ 
+	for (const Target &target:  targets) {
+		if (target.is_file())
+			Probe::invalidate(target.get_name_c_str_nondynamic()); 
+	}
+	Probe::finished_job(); 
+
+	bool success= job.waited(status, pid); 
+
+	if (Timeline::enabled())
+		Timeline::job(timeline_lane, targets.front().format_src(), rule->place,
+			   pid, status, job.get_time_start(), job.get_duration()); 
+
+	if (Accounting::enabled())
+		Accounting::add(targets.front().format_src(), param_rule->place.as_argv0(),
+				job.get_rusage(), job.get_rss(), job.get_duration(), status); 
+
+	if (Critical::enabled())
+		job_last= Critical::add(targets.front().format_src(), job.get_time_start(),
+					job.get_time_start() + job.get_duration(), job_last); 
+
+	/* Failed jobs are recorded too, as they may have failed because
+	 * they ran out of memory */
+	if (History::filename)
+		History::set_rss(*param_rule, job.get_rss()); 
+
+	if (success) {
 		/* Command was successful */ 
 
+		if (History::filename) {
+			for (const Target &target:  targets)
+				History::set_duration(target, job.get_duration()); 
+		}
+
 		bits |=  B_EXISTING; 
 		bits &= ~B_MISSING;
 		/* Subsequently set to B_MISSING if at least one target file is missing */
 
+		bool unchanged= ! rule->place_restat.empty();
+		/* With the -r flag, whether the command has changed none
+		 * of the file targets.  Set to false as soon as one file
+		 * target is found to be changed.  */
+
 		/* For file targets, check that the file was built */ 
 		for (size_t i= 0;  i < targets.size();  ++i) {
 			const Target target= targets[i]; 
@@ -1988,7 +2628,7 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 			const char *const filename= target.get_name_c_str_nondynamic();
 			struct stat buf;
 
-			if (0 == stat(filename, &buf)) {
+			if (0 == Probe::stat(filename, &buf)) {
 
 				/* The file exists */ 
 
@@ -1997,9 +2637,20 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 						 rule->place_param_targets[i]->place,
 						 "after execution of command"); 
 
+				Timestamp timestamp_file(&buf);
+
+				/* With the -r flag, the file may have been left
+				 * unchanged by the command, in which case it is
+				 * not checked against Stu startup */ 
+				if (! rule->place_restat.empty()
+				    && timestamps_old[i].defined()
+				    && ! (timestamps_old[i] < timestamp_file)
+				    && ! (timestamp_file < timestamps_old[i]))
+					continue;
+				unchanged= false; 
+
 				/* Check that file is not older that Stu
 				 * startup */ 
-				Timestamp timestamp_file(&buf);
 				if (! timestamp.defined() ||
 				    timestamp < timestamp_file)
 					timestamp= timestamp_file; 
@@ -2008,6 +2659,7 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 
 					/* Check whether the file is actually a symlink, in
 					 * which case we ignore that error */ 
+					Counters::add(Counters::C_STAT); 
 					if (0 > lstat(filename, &buf)) {
 						rule->place_param_targets[i]->place <<
 							system_format(target.format_err()); 
@@ -2028,6 +2680,7 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 					raise(ERROR_BUILD);
 				}
 			} else {
+				unchanged= false; 
 				bits |= B_MISSING; 
 				bits &= ~B_EXISTING;
 				rule->place_param_targets[i]->place <<
@@ -2037,6 +2690,30 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 				raise(ERROR_BUILD);
 			}
 		}
+
+		/* No file target was changed:  consider the targets to be
+		 * up to date, such that the parents are not rebuilt because
+		 * of them.  The timestamp is then that of the targets
+		 * themselves.  */ 
+		if (unchanged) {
+			Timestamp timestamp_targets= Timestamp::UNDEFINED;
+			for (size_t i= 0;  i < targets.size();  ++i) {
+				if (timestamps_old[i].defined() &&
+				    (! timestamp_targets.defined() ||
+				     timestamp_targets < timestamps_old[i]))
+					timestamp_targets= timestamps_old[i]; 
+			}
+			/* Undefined when there are no file targets */ 
+			if (timestamp_targets.defined()) {
+				Debug::print(this, "targets unchanged"); 
+				bits &= ~B_NEED_BUILD; 
+				timestamp= timestamp_targets; 
+			}
+		}
+
+		if (Digest::filename)
+			Digest::record(targets, inputs); 
+
 		/* In parallel mode, print "done" message */
 		if (option_parallel && !option_silent) {
 			string text= targets[0].format_src();
@@ -2082,6 +2759,12 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 		remove_if_existing(true); 
 		raise(ERROR_BUILD);
 	}
+
+	if (Progress::enabled()) {
+		Progress::add_finished(); 
+		if (Progress::due())
+			update_progress(); 
+	}
 }
 
 File_Execution::File_Execution(shared_ptr <const Dep> dep,
@@ -2094,8 +2777,14 @@ File_Execution::File_Execution(shared_ptr <const Dep> dep,
 	   timestamps_old(nullptr),
 	   filenames(nullptr),
 	   rule(rule_),
+	   time_pool_refused(-1),
+	   time_memory_refused(-1),
+	   rss_reserved(0),
+	   timeline_lane(0),
+	   duration_pending(-1),
 	   done(0)
 {
+	Counters::add(Counters::C_EXECUTION_FILE); 
 	assert((param_rule_ == nullptr) == (rule_ == nullptr)); 
 
 	swap(mapping_parameter, mapping_parameter_); 
@@ -2105,7 +2794,7 @@ File_Execution::File_Execution(shared_ptr <const Dep> dep,
 	Target target_no_flags= target_;
 	target_no_flags.get_front_word_nondynamic() &= F_TARGET_TRANSIENT; 
 	targets.push_back(target_no_flags); 
-	executions_by_target[target_no_flags]= this; 
+	cache(target_no_flags); 
 
 	parents[parent]= dep; 
 	if (error_additional) {
@@ -2129,7 +2818,14 @@ File_Execution::File_Execution(shared_ptr <const Dep> dep,
 	/* Fill EXECUTIONS_BY_TARGET with all targets from the rule, not
 	 * just the one given in the dependency.  */
 	for (const Target &target:  targets) {
-		executions_by_target[target]= this; 
+		cache(target); 
+	}
+
+	if (Progress::enabled() && rule != nullptr
+	    && (rule->command != nullptr || rule->is_copy) && ! rule->is_hardcode) {
+		duration_pending= History::filename 
+			? History::get_duration(targets.front()) : 0; 
+		Progress::add_pending(duration_pending); 
 	}
 
 	if (rule != nullptr) {
@@ -2148,7 +2844,7 @@ File_Execution::File_Execution(shared_ptr <const Dep> dep,
 				/* Check that the file is present,
 				 * or make it an error */ 
 				struct stat buf;
-				int ret_stat= stat(target_.get_name_c_str_nondynamic(), &buf);
+				int ret_stat= Probe::stat(target_.get_name_c_str_nondynamic(), &buf);
 				if (0 > ret_stat) {
 					if (errno != ENOENT) {
 						string text= target_.format_err();
@@ -2274,17 +2970,27 @@ void job_terminate_all()
 	 * for removing all target files.  This could also be merged
 	 * into a single loop.  */
 
-	for (size_t i= 0;
-	     i < File_Execution::executions_by_pid_size;
-	     ++i) {
+	/* The table is null when no job was started yet */ 
+	const size_t size_table= File_Execution::executions_by_pid_key
+		? File_Execution::executions_by_pid_mask + 1 : 0; 
+
+	for (size_t i= 0;  i < size_table;  ++i) {
 		const pid_t pid= File_Execution::executions_by_pid_key[i];
+		if (pid == 0)
+			continue; 
 
 		Job::kill(pid); 
 	}
 
+	/* Copy threads must not write targets anymore once they are
+	 * removed */
+	Copy::cancel(); 
+
 	size_t count_terminated= 0;
 
-	for (size_t i= 0;  i < File_Execution::executions_by_pid_size;  ++i) {
+	for (size_t i= 0;  i < size_table;  ++i) {
+		if (File_Execution::executions_by_pid_key[i] == 0)
+			continue; 
 		if (File_Execution::executions_by_pid_value[i]->remove_if_existing(false))
 			++count_terminated;
 	}
@@ -2328,10 +3034,11 @@ void job_terminate_all()
 
 void job_print_jobs()
 {
-	for (size_t i= 0;  
-	     i < File_Execution::executions_by_pid_size;
-	     ++i) {
-		File_Execution::executions_by_pid_value[i]->print_as_job(); 
+	if (! File_Execution::executions_by_pid_key)
+		return; 
+	for (size_t i= 0;  i <= File_Execution::executions_by_pid_mask;  ++i) {
+		if (File_Execution::executions_by_pid_key[i] != 0)
+			File_Execution::executions_by_pid_value[i]->print_as_job(); 
 	}
 }
 
@@ -2372,6 +3079,9 @@ bool File_Execution::remove_if_existing(bool output)
 			
 		removed= true;
 
+		if (output)
+			Probe::invalidate(filename); 
+
 		if (0 > unlink(filename)) {
 			if (output) {
 				rule->place << system_format(name_format_err(filename)); 
@@ -2591,9 +3301,12 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 			if (! target.is_file()) 
 				continue;
 
-			/* We save the return value of stat() and handle errors later */ 
+			/* We save the return value of stat() and handle errors
+			 * later.  A file without a command may have been
+			 * created by any job.  */ 
 			struct stat buf;
-			int ret_stat= stat(target.get_name_c_str_nondynamic(), &buf);
+			int ret_stat= Probe::stat(target.get_name_c_str_nondynamic(),
+						  &buf, no_execution);
 
 			/* Warn when file has timestamp in the future */ 
 			if (ret_stat == 0) { 
@@ -2716,8 +3429,18 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 		}
 	}
 
+	/* With -H, the target does not have to be built when its
+	 * content and that of its inputs are as recorded */ 
+	if (Digest::filename && (bits & B_NEED_BUILD) && ! (bits & B_MISSING) 
+	    && ! no_execution && Digest::unchanged(targets, inputs)) {
+		Debug::print(this, "digests unchanged"); 
+		bits &= ~B_NEED_BUILD; 
+	}
+
 	if (! (bits & B_NEED_BUILD)) {
 		/* The file does not have to be built */ 
+		if (Digest::filename && ! no_execution)
+			Digest::record(targets, inputs); 
 		done |= done_from_flags(dep_this->flags); 
 		return proceed |= P_FINISHED; 
 	}
@@ -2747,6 +3470,7 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 	}
 
 	out_message_done= true;
+	set_stale(); 
 
 	assert(jobs >= 0); 
 
@@ -2771,6 +3495,47 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 	if (jobs == 0) {
 		return proceed |= P_WAIT;
 	}
+
+	/* With a memory budget, the estimated memory of the job must
+	 * also fit.  When it doesn't, a job with a nonzero estimate is
+	 * running, and we will be called again when a job has
+	 * finished.  The memory is reserved below, once the job also
+	 * has a slot of its pool.  */
+	long estimate= 0;
+	if (Memory::budget) {
+		estimate= History::get_rss(*param_rule); 
+		if (! Memory::fits(estimate)) {
+			Debug::print(this, frmt("wait for memory (%ld kB)", estimate)); 
+			if (time_memory_refused < 0)
+				time_memory_refused= Job::get_time(); 
+			return proceed |= P_WAIT;
+		}
+	}
+
+	/* A job in a pool also needs a free slot of the pool.  Since
+	 * the pool is full, at least one of its jobs is running, and
+	 * we will be called again when a job has finished.  */
+	if (rule->pool) {
+		if (! rule->pool->acquire()) {
+			Debug::print(this, frmt("wait for pool %s", rule->pool->name.c_str())); 
+			if (time_pool_refused < 0)
+				time_pool_refused= Job::get_time(); 
+			return proceed |= P_WAIT;
+		}
+		if (time_pool_refused >= 0) {
+			rule->pool->add_waiting(Job::get_time() - time_pool_refused); 
+			time_pool_refused= -1; 
+		}
+	}
+
+	if (Memory::budget) {
+		Memory::reserve(estimate); 
+		rss_reserved= estimate; 
+		if (time_memory_refused >= 0) {
+			Memory::add_waiting(Job::get_time() - time_memory_refused); 
+			time_memory_refused= -1; 
+		}
+	}
        
 	/* We have to start a job now */ 
 
@@ -2781,7 +3546,9 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 			continue; 
 		Timestamp timestamp_now= Timestamp::now(); 
 		assert(timestamp_now.defined()); 
-		assert(transients.count(target.get_name_nondynamic()) == 0); 
+		/* In watch mode, a transient executed in a previous
+		 * build may have to be executed again */ 
+		assert(option_watch || transients.count(target.get_name_nondynamic()) == 0); 
 		transients[target.get_name_nondynamic()]= timestamp_now; 
 	}
 
@@ -2802,7 +3569,6 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 	mapping_variable.clear(); 
 
 	pid_t pid; 
-	size_t index; /* In EXECUTIONS_BY_PID_* */
 	{
 		/* Block signals from the time the process is started,
 		 * to after we have entered it in the map.  Note:  if we
@@ -2832,6 +3598,10 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 					/* Neither the source file nor
 					 * the target file exist:  an
 					 * error  */
+					if (rss_reserved) {
+						Memory::release(rss_reserved); 
+						rss_reserved= 0; 
+					}
 					rule->deps.at(0)->get_place()
 						<< fmt("source file %s in optional copy rule must exist",
 						       name_format_err(source));
@@ -2865,6 +3635,12 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 
 		if (pid < 0) {
 			/* Starting the job failed */ 
+			if (rule->pool)
+				rule->pool->release(); 
+			if (rss_reserved) {
+				Memory::release(rss_reserved); 
+				rss_reserved= 0; 
+			}
 			*this << fmt("error executing command for %s", 
 				     targets.front().format_err()); 
 			raise(ERROR_BUILD);
@@ -2874,61 +3650,19 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 			return proceed;
 		}
 
-		assert(!executions_by_pid_key == !executions_by_pid_value);
+#ifndef NDEBUG
+		size_t index= insert_pid(pid, this); 
+		assert(executions_by_pid_value[index]->job.started()); 
+		assert(pid == executions_by_pid_value[index]->job.get_pid()); 
+#else
+		insert_pid(pid, this); 
+#endif
+	}
 
-		if (!executions_by_pid_key) {
-			/* This is executed just once, before we have
-			 * executed any job, and therefore JOBS is the
-			 * value passed via -j (or its default value 1),
-			 * and thus we can allocate arrays of that size
-			 * once and for all.  */
-			if (SIZE_MAX / sizeof(*executions_by_pid_key) < (size_t)jobs ||
-			    SIZE_MAX / sizeof(*executions_by_pid_value) < (size_t)jobs) {
-				errno= ENOMEM;
-				perror("malloc"); 
-				exit(ERROR_FATAL); 
-			}
-			executions_by_pid_key  = (pid_t *)          malloc(jobs * sizeof(*executions_by_pid_key));
-			executions_by_pid_value= (File_Execution **)malloc(jobs * sizeof(*executions_by_pid_value)); 
-			if (!executions_by_pid_key || !executions_by_pid_value) {
-				perror("malloc"); 
-				exit(ERROR_FATAL); 
-			}
-		}
+	if (Timeline::enabled())
+		timeline_lane= Timeline::acquire_lane(); 
+	leave_pending(); 
 
-		size_t mi= 0, ma= executions_by_pid_size;
-		/* Both are exclusive */
-		assert(mi <= ma); 
-		while (mi < ma) {
-			size_t ne= mi + (ma - mi) / 2;
-			assert(ne < ma); 
-			assert(ne < executions_by_pid_size); 
-			assert(executions_by_pid_key[ne] != pid); 
-			if (executions_by_pid_key[ne] < pid) {
-				mi= ne + 1;
-			} else {
-				ma= ne;
-			}
-		}
-		assert(mi == ma); 
-		assert(mi <= executions_by_pid_size); 
-		assert(mi == 0 || executions_by_pid_key[mi - 1] < pid); 
-		assert(mi == executions_by_pid_size || executions_by_pid_key[mi] > pid); 
-		index= mi; 
-
-		memmove(executions_by_pid_key + index + 1,
-			executions_by_pid_key + index,
-			sizeof(*executions_by_pid_key) * (executions_by_pid_size - index));
-		memmove(executions_by_pid_value + index + 1,
-			executions_by_pid_value + index,
-			sizeof(*executions_by_pid_value) * (executions_by_pid_size - index)); 
-		++ executions_by_pid_size; 
-		executions_by_pid_key[index]= pid;
-		executions_by_pid_value[index]= this;
-	}
-
-	assert(executions_by_pid_value[index]->job.started()); 
-	assert(pid == executions_by_pid_value[index]->job.get_pid()); 
 	--jobs;
 	assert(jobs >= 0);
 
@@ -2938,6 +3672,31 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 	return proceed;
 }
 
+void File_Execution::leave_pending()
+{
+	if (duration_pending < 0)
+		return;
+	Progress::remove_pending(duration_pending); 
+	duration_pending= -1; 
+}
+
+void File_Execution::update_progress()
+{
+	double time= Job::get_time(); 
+	vector <Progress::Running> running; 
+	for (size_t i= 0;  i <= executions_by_pid_mask;  ++i) {
+		if (executions_by_pid_key[i] == 0)
+			continue;
+		const File_Execution *execution= executions_by_pid_value[i]; 
+		double time_elapsed= time - execution->job.get_time_start(); 
+		double duration= History::filename 
+			? History::get_duration(execution->targets.front()) : 0; 
+		running.push_back({execution->targets.front().format_src(), time_elapsed,
+				   duration > time_elapsed ? duration - time_elapsed : 0}); 
+	}
+	Progress::update(running); 
+}
+
 void File_Execution::print_as_job() const
 {
 	pid_t pid= job.get_pid();
@@ -2948,6 +3707,8 @@ void File_Execution::print_as_job() const
 void File_Execution::write_content(const char *filename, 
 				   const Command &command)
 {
+	Probe::invalidate(filename); 
+
 	FILE *file= fopen(filename, "w"); 
 
 	if (file == nullptr) {
@@ -3017,6 +3778,7 @@ void File_Execution::read_variable(shared_ptr <const Dep> dep)
 	string dependency_variable_name;
 	string content; 
 	
+	Counters::add(Counters::C_OPEN); 
 	int fd= open(target.get_name_c_str_nondynamic(), O_RDONLY);
 	if (fd < 0) {
 		if (errno != ENOENT) {
@@ -3024,6 +3786,7 @@ void File_Execution::read_variable(shared_ptr <const Dep> dep)
 		}
 		goto error;
 	}
+	Counters::add(Counters::C_STAT); 
 	if (0 > fstat(fd, &buf)) {
 		dep->get_place() << target.format_err(); 
 		goto error_fd;
@@ -3103,7 +3866,7 @@ bool File_Execution::optional_finished(shared_ptr <const Dep> dep_link)
 			->place_param_target.place_name.unparametrized().c_str();
 
 		struct stat buf;
-		int ret_stat= stat(name, &buf);
+		int ret_stat= Probe::stat(name, &buf);
 		if (ret_stat < 0) {
 			bits |= B_MISSING;
 			bits &= ~B_EXISTING; 
@@ -3142,6 +3905,7 @@ bool Root_Execution::finished(Flags flags) const
 Root_Execution::Root_Execution(const vector <shared_ptr <const Dep> > &deps)
 	:  is_finished(false)
 {
+	Counters::add(Counters::C_EXECUTION_ROOT); 
 	for (auto &d:  deps) {
 		push(d); 
 	}
@@ -3181,6 +3945,7 @@ Concat_Execution::Concat_Execution(shared_ptr <const Concat_Dep> dep_,
 	:  dep(dep_),
 	   stage(0)
 {
+	Counters::add(Counters::C_EXECUTION_CONCAT); 
 	assert(dep_); 
 	assert(dep_->is_normalized()); 
 	assert(dep->is_normalized()); 
@@ -3346,6 +4111,7 @@ Dynamic_Execution::Dynamic_Execution(shared_ptr <const Dynamic_Dep> dep_,
 	:  dep(dep_),
 	   is_finished(false)
 {
+	Counters::add(Counters::C_EXECUTION_DYNAMIC); 
 	assert(dep_); 
 	assert(dep_->is_normalized()); 
 	assert(parent); 
@@ -3371,6 +4137,7 @@ Dynamic_Execution::Dynamic_Execution(shared_ptr <const Dynamic_Dep> dep_,
 				   inner_plain_dep->place_param_target.place_name.unparametrized());
 		Target target= dep->get_target(); 
 		try {
+			Timeline::Span span("rule lookup"); 
 			map <string, string> mapping_parameter; 
 			shared_ptr <const Rule> rule= 
 				rule_set.get(target_base, param_rule, mapping_parameter, 
@@ -3382,7 +4149,7 @@ Dynamic_Execution::Dynamic_Execution(shared_ptr <const Dynamic_Dep> dep_,
 			raise(e); 
 			return; 
 		}
-		executions_by_target[target]= this; 
+		cache(target); 
 	}
 
 	parents.erase(parent); 
@@ -3477,9 +4244,9 @@ void Dynamic_Execution::notify_result(shared_ptr <const Dep> d,
 }
 
 Transient_Execution::~Transient_Execution()
-/* Objects of this type are never deleted */ 
+/* Objects of this type are only deleted in watch mode */ 
 {
-	assert(false);
+	/* Nop */ 
 }
 
 Proceed Transient_Execution::execute(shared_ptr <const Dep> dep_this)
@@ -3516,6 +4283,7 @@ Transient_Execution::Transient_Execution(shared_ptr <const Dep> dep_link,
 	   rule(rule_),
 	   is_finished(false)
 {
+	Counters::add(Counters::C_EXECUTION_TRANSIENT); 
 	swap(mapping_parameter, mapping_parameter_); 
 
 	assert(to <Plain_Dep> (dep_link)); 
@@ -3562,7 +4330,7 @@ Transient_Execution::Transient_Execution(shared_ptr <const Dep> dep_link,
 	for (Target t:  targets) {
 		t.get_front_word_nondynamic() |= (word_t)
 			(dep_link->flags & (F_TARGET_BYTE & ~F_TARGET_DYNAMIC)); 
-		executions_by_target[t]= this; 
+		cache(t); 
 	}
 
 	for (auto &dependency:  rule->deps) {
@@ -3609,6 +4377,9 @@ void Transient_Execution::notify_result(shared_ptr <const Dep> dep,
 
 void Debug::print(const Execution *e, string text) 
 {
+	if (! option_debug) 
+		return;
+
 	if (e == nullptr) {
 		print("", text);
 	} else {
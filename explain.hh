@@ -123,7 +123,8 @@ void explain_flags()
 {
 	if (! option_explain)  return;
 	fputs("Explanation: The valid flags are -p (persistent dependency), -o (optional dependency),\n"
-	      "and -t (trivial dependency).\n",
+	      "and -t (trivial dependency), as well as -r (restat rule) and -u (pool) before the targets\n"
+	      "of a rule.\n",
 	      stderr); 
 }
 
@@ -0,0 +1,235 @@
+#ifndef HISTORY_HH
+#define HISTORY_HH
+
+/*
+ * The history of job durations, used with the -T option.  For each
+ * target whose command was run successfully, Stu records the wall-clock
+ * time of the command.  In addition, for each target, Stu records the
+ * length of its critical path, i.e., of the longest chain of recorded
+ * durations through its direct and indirect dependencies, including the
+ * target's own command.  The critical path is computed as if all
+ * targets had to be rebuilt, i.e., targets that are up to date
+ * contribute the duration recorded for them before.
+ *
+ * With "-m critical", the critical paths from the previous invocation
+ * determine the order in which dependencies are executed:  Of the
+ * dependencies of a target, those with the longest critical path are
+ * started first.  Since execution proceeds from the top-level targets
+ * downwards, the job that is started first is the one that is followed
+ * by the longest chain of other jobs.  This shortens the total time of
+ * builds with -j, in which otherwise a long-running job may be started
+ * last, while the other jobs have all finished.  Which targets are
+ * built does not depend on the order.
+ *
+ * In addition, for each rule, Stu records the largest peak resident set
+ * size of its jobs in the last invocation in which jobs of the rule
+ * were run.  For parametrized rules, this is over all instantiations of
+ * the rule.  This is used by the memory budget given by the -B option
+ * (see memory.hh).
+ *
+ * The history is stored in a state file (see state.hh), whose fields
+ * are records of the form
+ *
+ *    D TARGET DURATION CRITICAL
+ *        Durations in seconds; DURATION is empty when no command of
+ *        the target has been run
+ *    M RULE RSS
+ *        RULE is the first target of the rule, including its
+ *        parameters; RSS is in kilobytes
+ *
+ * Targets are given in Stu syntax, e.g., "@all" for a transient target.
+ */
+
+#include <math.h>
+
+#include "state.hh"
+
+class History
+{
+public:
+	static const char *filename;
+	/* Set by the -T option; null when not used */
+
+	static void read();
+	/* Read the state file, if it exists */
+
+	static void write();
+	/* Write the state file, if anything has changed */
+
+	static double get_duration(const Target &target);
+	/* The recorded duration of the command of the target, or zero
+	 * when none is known */
+
+	static double get_critical(const Target &target);
+	/* The recorded length of the critical path of the target, or
+	 * zero when none is known */
+
+	static void set_duration(const Target &target, double duration);
+	static void set_critical(const Target &target, double critical);
+
+	static long get_rss(const Rule &rule);
+	/* The estimated peak resident set size of a job of the given
+	 * parametrized rule in kilobytes, or zero when none is known */
+
+	static void set_rss(const Rule &rule, long rss);
+	/* Record the peak resident set size of a job of the given
+	 * parametrized rule */
+
+private:
+	struct Entry
+	{
+		double duration;
+		/* Negative when not known */
+
+		double critical;
+	};
+
+	static const char *const header;
+
+	struct Entry_Rss
+	{
+		long rss_old;
+		/* As read from the file; zero when not known */
+
+		long rss_new;
+		/* The maximum of the current invocation; zero when no job
+		 * of the rule was run */
+	};
+
+	static unordered_map <string, Entry> entries;
+	static unordered_map <string, Entry_Rss> entries_rss;
+
+	static bool changed;
+	/* Whether ENTRIES was changed since reading */
+
+	static string key(const Target &target);
+	static string key(const Rule &rule);
+};
+
+const char *History::filename= nullptr;
+const char *const History::header= "stu history 1";
+unordered_map <string, History::Entry> History::entries;
+unordered_map <string, History::Entry_Rss> History::entries_rss;
+bool History::changed= false;
+
+void History::read()
+{
+	assert(filename);
+
+	vector <string> fields;
+	if (! read_state(filename, header, fields))
+		return;
+
+	for (size_t i= 0;  i < fields.size();) {
+		if (fields[i] == "D" && i + 4 <= fields.size()) {
+			Entry &entry= entries[fields[i + 1]];
+			entry.duration= fields[i + 2].empty() ? -1 :
+				strtod(fields[i + 2].c_str(), nullptr);
+			entry.critical= strtod(fields[i + 3].c_str(), nullptr);
+			i += 4;
+		} else if (fields[i] == "M" && i + 3 <= fields.size()) {
+			long rss= strtol(fields[i + 2].c_str(), nullptr, 10);
+			entries_rss[fields[i + 1]]= Entry_Rss{max(rss, 0L), 0};
+			i += 3;
+		} else {
+			/* Invalid file */
+			entries.clear();
+			entries_rss.clear();
+			return;
+		}
+	}
+}
+
+void History::write()
+{
+	assert(filename);
+
+	if (! changed)
+		return;
+
+	vector <string> fields;
+	for (const auto &i:  entries) {
+		fields.push_back("D");
+		fields.push_back(i.first);
+		fields.push_back(i.second.duration < 0 ? "" :
+				 frmt("%.6f", i.second.duration));
+		fields.push_back(frmt("%.6f", i.second.critical));
+	}
+	for (const auto &i:  entries_rss) {
+		fields.push_back("M");
+		fields.push_back(i.first);
+		fields.push_back(frmt("%ld", i.second.rss_new ? i.second.rss_new
+				      : i.second.rss_old));
+	}
+	write_state(filename, header, fields, 'T');
+}
+
+double History::get_duration(const Target &target)
+{
+	auto i= entries.find(key(target));
+	if (i == entries.end() || i->second.duration < 0)
+		return 0;
+	return i->second.duration;
+}
+
+double History::get_critical(const Target &target)
+{
+	auto i= entries.find(key(target));
+	if (i == entries.end())
+		return 0;
+	return i->second.critical;
+}
+
+void History::set_duration(const Target &target, double duration)
+{
+	auto i= entries.emplace(key(target), Entry{-1, 0}).first;
+	i->second.duration= duration;
+	changed= true;
+}
+
+void History::set_critical(const Target &target, double critical)
+{
+	auto i= entries.emplace(key(target), Entry{-1, 0}).first;
+	/* Ignore differences below a millisecond, which may be due to
+	 * the rounding in the state file, such that null builds don't
+	 * rewrite it */
+	if (fabs(i->second.critical - critical) < 1e-3)
+		return;
+	i->second.critical= critical;
+	changed= true;
+}
+
+long History::get_rss(const Rule &rule)
+{
+	auto i= entries_rss.find(key(rule));
+	if (i == entries_rss.end())
+		return 0;
+	return max(i->second.rss_old, i->second.rss_new);
+}
+
+void History::set_rss(const Rule &rule, long rss)
+{
+	if (rss <= 0)
+		return;
+	auto i= entries_rss.emplace(key(rule), Entry_Rss{0, 0}).first;
+	if (rss <= i->second.rss_new)
+		return;
+	i->second.rss_new= rss;
+	changed= true;
+}
+
+string History::key(const Target &target)
+{
+	/* File targets may carry flags, which are not part of their
+	 * identity */
+	if (target.is_file())
+		return Target(0, target.get_name_nondynamic()).format_src();
+	return target.format_src();
+}
+
+string History::key(const Rule &rule)
+{
+	return rule.place_param_targets.front()->format_src();
+}
+
+#endif /* ! HISTORY_HH */
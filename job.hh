@@ -3,13 +3,35 @@
 
 /* 
  * Handling of child processes, including signal-related issues. 
+ *
+ * Child processes are created with vfork() rather than fork().  With
+ * fork(), the page tables of Stu are copied for each job, which takes
+ * time proportional to the memory used by Stu, i.e., to the size of the
+ * dependency graph.  With vfork(), the child borrows the memory of Stu
+ * until it calls execve(), and Stu is suspended until then.  Therefore,
+ * everything the child needs is prepared beforehand, and the child
+ * itself only calls async-signal-safe functions, and does not change
+ * any variables.  Compile with -DUSE_VFORK=0 to use fork() instead,
+ * e.g., to compare the two with sh/benchspawn. 
  */
 
 #include <fcntl.h>
 #include <signal.h>
+#include <string.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
 
+#include "copy.hh"
+
+#ifdef __linux__
+#    include <poll.h>
+#    include <sys/signalfd.h>
+#endif
+
+#ifndef USE_VFORK
+#   define USE_VFORK 1
+#endif
+
 void job_terminate_all(); 
 /* Called to terminate all running processes, and remove their target
  * files if present.  Implemented in execution.hh, and called from
@@ -93,9 +115,49 @@ public:
 	/* Start a copy job.  The return value has the same semantics as
 	 * in start().  */  
 
-	static pid_t wait(int *status);
+	double get_duration() const {
+		assert(pid == -1); 
+		return time_end - time_start;
+	}
+	/* The wall-clock time of the job in seconds, from its start until
+	 * it was waited for.  The job must have been waited for.  */
+
+	double get_time_start() const {  return time_start;  }
+	/* As returned by get_time(); the job must have been started */
+
+	const struct rusage &get_rusage() const {
+		assert(pid == -1); 
+		return rusage;
+	}
+	/* The resource usage of the job, including that of the
+	 * processes it waited for.  All zero for copies.  The job must
+	 * have been waited for.  */
+
+	long get_rss() const {
+		assert(pid == -1); 
+		/* On macOS, the value is in bytes instead of kilobytes */ 
+#ifdef __APPLE__
+		return rusage.ru_maxrss / 1024;
+#else
+		return rusage.ru_maxrss;
+#endif
+	}
+	/* The peak resident set size of the job in kilobytes, or zero
+	 * when not known.  The job must have been waited for.  */
+
+	static double get_time(); 
+	/* The current time of the monotonic clock in seconds */
+
+	static pid_t wait(int *status, bool block);
 	/* Wait for the next process to terminate; provide the STATUS as
-	 * used in wait(2).  Return the PID of the waited-for process (>=0). */  
+	 * used in wait(2).  Return the PID of the waited-for process
+	 * (>=0).  When BLOCK is false, return 0 when no process has
+	 * terminated.  When BLOCK is true, also return 0 when
+	 * TIMEOUT_WAIT has passed without a process terminating.  */  
+
+	static int timeout_wait;
+	/* In milliseconds, or -1 to wait indefinitely.  Only used on
+	 * Linux; elsewhere, wait() always waits indefinitely.  */
 
 	static void print_statistics(bool allow_unterminated_jobs= false); 
 	/* Print the statistics about jobs, regardless of OPTION_STATISTICS.  If
@@ -134,6 +196,17 @@ private:
 	 * -1:    process has been waited for. 
 	 */
 
+	double time_start, time_end;
+	/* As returned by get_time(); set when the job is started and
+	 * waited for */
+
+	struct rusage rusage;
+	/* Set when the job is waited for */
+
+	static struct rusage rusage_last;
+	/* The resource usage of the process last returned by wait(), as
+	 * given by wait4().  All zero for copies.  */
+
 	static void handler_termination(int sig);
 	static void handler_productive(int sig, siginfo_t *, void *);
 	
@@ -141,6 +214,30 @@ private:
 	/* Set up all signals.   May be called multiple times, and will
 	 * do the setup only the first time  */
 
+	static bool block_signals(sigset_t *set_old); 
+	/* Block all signals before creating a child process, and store
+	 * the previous mask in SET_OLD.  On error, output a message and
+	 * return false.  Between vfork() and execve(), the signal
+	 * handlers of Stu must not be called in the child, as they
+	 * would run on the memory of Stu.  */
+
+	static void init_child(); 
+	/* Called in the child process:  reset the termination signals
+	 * to their default action, and set the process group.  All
+	 * signals remain blocked.  */
+
+	static pid_t init_parent(pid_t pid_child, const sigset_t *set_old); 
+	/* Called in the parent after vfork() or fork() with its return
+	 * value:  set the process group of the child and restore the
+	 * signal mask.  On error, output a message and return -1,
+	 * otherwise return PID_CHILD.  */
+
+	static void exit_child(const char *name); 
+	/* Output an error message about NAME and ERRNO, and terminate
+	 * the child process with status 127, as done e.g. by system(),
+	 * posix_spawn(), and the shell.  Only async-signal-safe
+	 * functions are used, as required after vfork().  */
+
 	static size_t count_jobs_exec, count_jobs_success, count_jobs_fail;
 	/* 
 	 * The number of jobs run.  Each job is/was of exactly one
@@ -157,11 +254,8 @@ private:
 	 * "termination" or in the "productive" set.  The third variable
 	 * holds both.  */ 
 
-	static sig_atomic_t in_child; 
-	/* Set to 1 in the child process, before execve() is called.
-	 * Used to avoid doing too much in the terminating signal
-	 * handler.  Note: There is a race condition because the signal
-	 * handler may be called before the variable is set.  */
+	static const int signals_termination[]; 
+	/* The signals in SET_TERMINATION */ 
 
 	static pid_t foreground_pid;
 	/* The job that is in the foreground, or -1 when none is */ 
@@ -170,6 +264,54 @@ private:
 	/* The file descriptor of the TTY used by Stu.  -1 if there is none. */
 
 	static bool signals_initialized; 
+
+	static int fd_signal;
+	/* The signalfd on which the productive signals are received, or
+	 * -1 when not yet created.  Only used on Linux.  */
+
+	static bool wait_signal(); 
+	/* Wait until a productive signal is received.  Handles SIGUSR1
+	 * itself.  May also return without a signal having been
+	 * received.  Return false when TIMEOUT_WAIT has passed.  */
+
+	static vector <const char *> env_template; 
+	/* The environment of Stu, followed by $STU_STATUS, without the
+	 * terminating null pointer.  Variables set by a job replace
+	 * entries or are appended to a copy of it.  */
+
+	static unordered_map <string, size_t> env_index; 
+	/* The index in ENV_TEMPLATE of each variable by name */ 
+
+	static void init_env(); 
+	/* Initialize ENV_TEMPLATE and ENV_INDEX.  May be called
+	 * multiple times, and will do the setup only the first time.  */
+
+	static unordered_map <string, string> programs;
+	/* The programs found in $PATH by name, or "" when not found */ 
+
+	static bool get_simple(const string &command,
+			       const map <string, string> &mapping,
+			       vector <string> &words,
+			       string &program); 
+	/* Whether COMMAND is simple enough to be executed without the
+	 * shell, in which case WORDS is set to the arguments and
+	 * PROGRAM to the file to execute.  A command is simple when it
+	 * is a single line consisting of words separated by spaces and
+	 * tabs, the words contain only characters without special
+	 * meaning to the shell and parameters $NAME and ${NAME}, the
+	 * values of these parameters also contain only such
+	 * characters, and the first word is a program that is not
+	 * built into the shell.  In all other cases, and when in
+	 * doubt, the shell is used.  */
+
+	static const char *get_variable(const char *name, 
+					const map <string, string> &mapping);
+	/* The value of the environment variable in a job with the
+	 * given MAPPING, or null when it is not set */ 
+
+	static bool is_simple_char(char c);
+	/* Whether the character has no special meaning to the shell,
+	 * apart from separating words and from '$' */
 };
 
 size_t Job::count_jobs_exec=    0;
@@ -178,10 +320,21 @@ size_t Job::count_jobs_fail=    0;
 sigset_t Job::set_termination;
 sigset_t Job::set_productive;
 sigset_t Job::set_termination_productive;
-sig_atomic_t Job::in_child= 0; 
+const int Job::signals_termination[]= {
+	/* These are all signals that by default would terminate the
+	 * process.  */   
+	SIGTERM, SIGINT, SIGQUIT, SIGABRT, SIGSEGV, SIGPIPE, 
+	SIGILL, SIGHUP, 
+};
 pid_t Job::foreground_pid= -1;
 int Job::tty= -1;
 bool Job::signals_initialized; 
+int Job::fd_signal= -1;
+int Job::timeout_wait= -1;
+struct rusage Job::rusage_last; 
+vector <const char *> Job::env_template;
+unordered_map <string, size_t> Job::env_index; 
+unordered_map <string, string> Job::programs; 
 
 #ifndef NDEBUG
 bool Job::Signal_Blocker::blocked= false; 
@@ -215,208 +368,200 @@ pid_t Job::start(string command,
 		if (shell == nullptr || shell[0] == '\0') 
 			shell= "/bin/sh"; 
 	}
-	
-	const char *arg= command.c_str(); 
-	/* c_str() never returns nullptr, as by the standard */ 
-	assert(arg != nullptr);
-
-	pid= fork();
 
-	if (pid < 0) {
-		print_error_system("fork"); 
-		assert(pid == -1); 
-		return -1; 
+	/* Simple commands are executed directly, without the shell.
+	 * This is only done with the default shell, because another
+	 * shell may give other meanings to the command.  */
+	vector <string> words;
+	string program; 
+	bool simple= ! strcmp(shell, "/bin/sh") &&
+		get_simple(command, mapping, words, program); 
+	
+	/* 
+	 * Special handling of the case when the command starts with
+	 * '-' or '+'.  In that case, we prepend a space to the command.
+	 * We cannot use '--' as prescribed by POSIX because Linux and
+	 * FreeBSD handle '--' differently: 
+	 *
+	 *      /bin/sh -c -- '+x' 
+	 *      on Linux: Execute the command '+x'
+	 *      on FreeBSD: Execute the command '--' and set
+	 *                  the +x option
+	 *
+	 *      /bin/sh -c +x
+	 *      on Linux: Set the +x option, and missing
+	 *                argument to -c
+	 *      on FreeBSD: Execute the command '+x'
+	 *
+	 * See:
+	 * http://stackoverflow.com/questions/37886661/handling-of-in-arguments-of-bin-sh-posix-vs-implementations-by-bash-dash 
+	 *
+	 * It seems that FreeBSD violates POSIX in this regard. 
+	 */
+	if (command[0] == '-' || command[0] == '+') 
+		command= ' ' + command;
+
+	/* Set variables.  The added variables are written into a
+	 * single buffer as KEY=VALUE, each terminated by '\0', and
+	 * ENVP is the template with pointers into that buffer.  */ 
+	init_env(); 
+
+	size_t len_buffer= 0;
+	for (auto j= mapping.begin();  j != mapping.end();  ++j) 
+		len_buffer += j->first.size() + 1 + j->second.size() + 1; 
+	string buffer;
+	buffer.reserve(len_buffer); 
+	/* Not reallocated afterwards, such that pointers into it
+	 * remain valid */
+
+	vector <const char *> envp;
+	envp.reserve(env_template.size() + mapping.size() + 1); 
+	envp= env_template; 
+	for (auto j= mapping.begin();  j != mapping.end();  ++j) {
+		assert(j->first.find('=') == string::npos); 
+		const char *combined= buffer.data() + buffer.size(); 
+		buffer += j->first;
+		buffer += '='; 
+		buffer += j->second; 
+		buffer += '\0'; 
+		auto i= env_index.find(j->first); 
+		if (i != env_index.end()) 
+			envp[i->second]= combined; 
+		else
+			envp.push_back(combined); 
+	}
+	assert(buffer.size() == len_buffer); 
+	envp.push_back(nullptr); 
+
+	/* As $0 of the process, we pass the filename of the command
+	 * followed by a colon, the line number, a colon and the column
+	 * number.  This makes the shell if it reports an error make
+	 * the most useful output.  */
+	string argv0= place_command.as_argv0();
+	if (argv0 == "")
+		argv0= shell; 
+
+	/* The one-character options to the shell */
+	/* We use the -e option ('error'), which makes the shell abort
+	 * on a command that fails.  This is also what POSIX prescribes
+	 * for Make.  It is particularly important for Stu, as Stu
+	 * invokes the whole (possibly multiline) command in one step. */
+	const char *shell_options= option_individual ? "-ex" : "-e"; 
+
+	vector <const char *> argv_simple;
+	if (simple) {
+		for (const string &word:  words) 
+			argv_simple.push_back(word.c_str()); 
+		argv_simple.push_back(nullptr); 
+
+		/* Output the command as the shell does with -x.  When
+		 * the shell is used as fallback, it does not output it
+		 * again.  */ 
+		if (option_individual) {
+			const char *ps4= get_variable("PS4", mapping); 
+			string text= ps4 ? ps4 : "+ "; 
+			for (size_t i= 0;  i < words.size();  ++i) {
+				if (i)  text += ' ';
+				text += words[i];
+			}
+			fprintf(stderr, "%s\n", text.c_str()); 
+			shell_options= "-e"; 
+		}
 	}
 
-	/* Each child process is given, as process group ID, its process
-	 * ID.  This ensures that we can kill each child by killing its
-	 * corresponding process group ID.  */
-
-	/* Execute this in both the child and parent */ 
-	int pid_child= pid;
-	if (pid_child == 0)
-		pid_child= getpid();
-	if (0 > setpgid(pid_child, pid_child)) {
-		/* This should only fail when we are the parent and the
-		 * child has already quit.  In that case we can ignore
-		 * the error, since the child is dead anyway, so there
-		 * is no need to kill it in the future.  */ 
+	/* c_str() never returns nullptr, as by the standard */ 
+	const char *argv[]= {argv0.c_str(), 
+			     shell_options, "-c", command.c_str(), nullptr}; 
+
+	/* vfork() must be called directly here, because the child
+	 * must not return from the function that called vfork() */ 
+	sigset_t set_old; 
+	if (! block_signals(&set_old)) {
+		pid= -1;
+		return -1; 
 	}
+#if USE_VFORK
+	pid_t pid_child= vfork(); 
+#else
+	pid_t pid_child= fork(); 
+#endif
 
-	if (pid == 0) {
+	if (pid_child == 0) {
 		/* We are the child process */ 
-		in_child= 1; 
+		init_child(); 
 
-		/* Instead of throwing exceptions, use perror() and
-		 * _Exit().  We return 127, as done e.g. by
-		 * system(), posix_spawn(), and the shell.  */ 
+		/* Instead of throwing exceptions, use exit_child(),
+		 * which returns 127.  */ 
 
 		/* Unblock/reset all signals.  As a general rule,
 		 * signals that are blocked before exec() will remain
 		 * blocked after exec().  Thus, unblock them here.  */ 
-		if (0 != sigprocmask(SIG_UNBLOCK, &set_termination_productive, nullptr)) {
-			perror("sigprocmask");
-			_Exit(127); 
-		}
+		if (0 != sigprocmask(SIG_SETMASK, &set_old, nullptr) ||
+		    0 != sigprocmask(SIG_UNBLOCK, &set_termination_productive, nullptr)) 
+			exit_child("sigprocmask");
 		::signal(SIGTTIN, SIG_DFL);
 		::signal(SIGTTOU, SIG_DFL); 
-		
-		/* Set variables */ 
-		size_t v_old= 0;
-
-		map <string, size_t> old;
-		/* Index of old variables */ 
-
-		while (envp_global[v_old]) {
-			const char *p= envp_global[v_old];
-			const char *q= p;
-			while (*q && *q != '=')  ++q;
-			string key_old(p, q-p);
-			old[key_old]= v_old;
-			++v_old;
-		}
 
-		const size_t v_new= mapping.size() + 1; 
-		/* Maximal size of added variables.  The "+1" is for $STU_STATUS */ 
-
-		const char** envp= (const char **)
-			malloc(sizeof(char **) * (v_old + v_new + 1));
-		if (!envp) {
-			assert(false);
-			perror("malloc");
-			_Exit(127); 
-		}
-		memcpy(envp, envp_global, v_old * sizeof(char **)); 
-		size_t i= v_old;
-		for (auto j= mapping.begin();  j != mapping.end();  ++j) {
-			string key= j->first;
-			string value= j->second;
-			assert(key.find('=') == string::npos); 
-			size_t len_combined= key.size() + 1 + value.size() + 1;
-			char *combined= (char *)malloc(len_combined);
-			if (! combined) {
-				assert(false);
-				perror("malloc");
-				_Exit(127); 
-			}
-			if ((ssize_t)(len_combined - 1) != snprintf(combined, len_combined, "%s=%s", key.c_str(), value.c_str())) {
-				perror("snprintf");
-				_Exit(127); 
-			}
-			if (old.count(key)) {
-				size_t v_index= old.at(key);
-				envp[v_index]= combined;
-			} else {
-				assert(i < v_old + v_new); 
-				envp[i++]= combined;
-			}
-		}
-		envp[i++]= "STU_STATUS=1";
-		assert(i <= v_old + v_new);
-		envp[i]= nullptr;
-
-		/* As $0 of the process, we pass the filename of the
-		 * command followed by a colon, the line number, a colon
-		 * and the column number.  This makes the shell if it
-		 * reports an error make the most useful output.  */
-		string argv0= place_command.as_argv0();
-		if (argv0 == "")
-			argv0= shell; 
-
-		/* The one-character options to the shell */
-		/* We use the -e option ('error'), which makes the shell abort
-		 * on a command that fails.  This is also what POSIX prescribes
-		 * for Make.  It is particularly important for Stu, as Stu
-		 * invokes the whole (possibly multiline) command in one step. */
-		const char *shell_options= option_individual ? "-ex" : "-e"; 
-
-		const char *argv[]= {argv0.c_str(), 
-				     shell_options, "-c", arg, nullptr}; 
-
-		/* 
-		 * Special handling of the case when the command
-		 * starts with '-' or '+'.  In that case, we prepend
-		 * a space to the command.  We cannot use '--' as
-		 * prescribed by POSIX because Linux and FreeBSD handle
-		 * '--' differently: 
-		 *
-		 *      /bin/sh -c -- '+x' 
-		 *      on Linux: Execute the command '+x'
-		 *      on FreeBSD: Execute the command '--' and set
-		 *                  the +x option
-		 *
-		 *      /bin/sh -c +x
-		 *      on Linux: Set the +x option, and missing
-		 *                argument to -c
-		 *      on FreeBSD: Execute the command '+x'
-		 *
-		 * See:
-		 * http://stackoverflow.com/questions/37886661/handling-of-in-arguments-of-bin-sh-posix-vs-implementations-by-bash-dash 
-		 *
-		 * It seems that FreeBSD violates POSIX in this regard. 
-		 */
-
-		if (arg[0] == '-' || arg[0] == '+') {
-			command= ' ' + command;
-			arg= command.c_str();
-			argv[3]= arg;
-		}
+		/* The names of the redirections are only taken here,
+		 * such that they are not kept in registers across
+		 * vfork(), which could clobber them.  c_str() only
+		 * returns a pointer.  */
 
 		/* Output redirection */
-		if (filename_output != "") {
+		const char *name_output= filename_output == "" 
+			? nullptr : filename_output.c_str(); 
+
+		/* Input redirection:  from the given file, or from
+		 * /dev/null (in non-interactive mode)  */
+		const char *name_input= filename_input != "" 
+			? filename_input.c_str() 
+			: option_interactive ? nullptr : "/dev/null"; 
+		
+		if (name_output) {
 			int fd_output= creat
-				(filename_output.c_str(), 
+				(name_output, 
 				 /* All +rw, i.e. 0666 */
 				 S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH); 
-			if (fd_output < 0) {
-				perror(filename_output.c_str());
-				_Exit(127); 
-			}
-			assert(fd_output != 1); 
-			int r= dup2(fd_output, 1); /* 1 = file descriptor of STDOUT */ 
-			if (r < 0) {
-				perror(filename_output.c_str());
-				_Exit(127); 
-			}
-			assert(r == 1);
+			if (fd_output < 0) 
+				exit_child(name_output); 
+			assert_async(fd_output != 1); 
+			/* 1 = file descriptor of STDOUT */ 
+			if (dup2(fd_output, 1) < 0) 
+				exit_child(name_output); 
 			close(fd_output); 
 		}
 
-		/* Input redirection:  from the given file, or from
-		 * /dev/null (in non-interactive mode)  */
-		if (filename_input != "" || ! option_interactive) {
-			const char *name= filename_input == ""
-				? "/dev/null"
-				: filename_input.c_str(); 
-			int fd_input= open(name, O_RDONLY); 
-			if (fd_input < 0) {
-				perror(name);
-				_Exit(127); 
-			}
-			assert(fd_input >= 3); 
-			int r= dup2(fd_input, 0); /* 0 = file descriptor of STDIN */  
-			if (r < 0) {
-				perror(name);
-				_Exit(127); 
-			}
-			assert(r == 0); 
-			if (close(fd_input) < 0) {
-				perror(name); 
-				_Exit(127); 
-			}
+		if (name_input) {
+			int fd_input= open(name_input, O_RDONLY); 
+			if (fd_input < 0) 
+				exit_child(name_input); 
+			assert_async(fd_input >= 3); 
+			/* 0 = file descriptor of STDIN */  
+			if (dup2(fd_input, 0) < 0) 
+				exit_child(name_input); 
+			if (close(fd_input) < 0) 
+				exit_child(name_input); 
 		}
 
-		int r= execve(shell, (char *const *) argv, (char *const *) envp); 
+		/* If the program cannot be executed directly for any
+		 * reason, e.g., because it is a script without '#!',
+		 * fall back to the shell, which also outputs the
+		 * usual error message */
+		if (simple) 
+			execve(program.c_str(), (char *const *) argv_simple.data(), 
+			       (char *const *) envp.data()); 
+
+		execve(shell, (char *const *) argv, (char *const *) envp.data()); 
 
-		/* If execve() returns, there is an error, and its return value is -1 */
-		assert(r == -1); 
-		perror("execve");
-		_Exit(127); 
+		/* If execve() returns, there is an error */
+		exit_child("execve"); 
 	} 
 
 	/* Here, we are the parent process */
 
-	assert(pid >= 1); 
+	pid= init_parent(pid_child, &set_old); 
+	if (pid < 0) 
+		return -1; 
 
 	if (option_interactive && tty >= 0) {
 		assert(foreground_pid < 0); 
@@ -425,13 +570,14 @@ pid_t Job::start(string command,
 		foreground_pid= pid; 
 	}
 		
+	time_start= get_time(); 
 	++ count_jobs_exec;
 
 	return pid; 
 }
 
 /* This function works analogously to start() with respect to invocation
- * of fork() and other system-related functions.  */
+ * of vfork() and other system-related functions.  */
 pid_t Job::start_copy(string target,
 		      string source)
 {
@@ -441,75 +587,163 @@ pid_t Job::start_copy(string target,
 
 	init_signals(); 
 
-	pid= fork();
+	/* We don't set $STU_STATUS for copy jobs */ 
 
-	if (pid < 0) {
-		print_error_system("fork"); 
-		assert(pid == -1); 
-		return -1; 
+	/* Without $STU_CP, Stu copies the file itself */ 
+	static const char *cp_command= nullptr;
+	if (cp_command == nullptr) {
+		cp_command= getenv("STU_CP");
+		if (cp_command == nullptr || cp_command[0] == '\0') 
+			cp_command= ""; 
+	}
+	if (cp_command[0] == '\0') {
+		pid= Copy::start(target, source); 
+		time_start= get_time(); 
+		++ count_jobs_exec;
+		return pid; 
 	}
 
-	int pid_child= pid;
-	if (pid_child == 0)
-		pid_child= getpid();
-	if (0 > setpgid(pid_child, pid_child)) {
-		/* no-op */ 
+	/* Using '--' as an argument guarantees that the two filenames
+	 * will be interpreted as filenames and not as options, in
+	 * particular when they begin with a dash.  */
+	const char *argv[]= {cp_command,
+			     "--",
+			     source.c_str(),
+			     target.c_str(),
+			     nullptr};
+
+	/* vfork() must be called directly here, because the child
+	 * must not return from the function that called vfork() */ 
+	sigset_t set_old; 
+	if (! block_signals(&set_old)) {
+		pid= -1;
+		return -1; 
 	}
+#if USE_VFORK
+	pid_t pid_child= vfork(); 
+#else
+	pid_t pid_child= fork(); 
+#endif
 
-	if (pid == 0) {
+	if (pid_child == 0) {
 		/* We are the child process */ 
+		init_child(); 
+		if (0 != sigprocmask(SIG_SETMASK, &set_old, nullptr))
+			exit_child("sigprocmask"); 
+		execv(cp_command, (char *const *) argv); 
+		exit_child("execv"); 
+	}
 
-		/* We don't set $STU_STATUS for copy jobs */ 
+	/* Parent execution */
+	pid= init_parent(pid_child, &set_old); 
+	if (pid < 0) 
+		return -1; 
 
-		static const char *cp_command= nullptr;
-		if (cp_command == nullptr) {
-			cp_command= getenv("STU_CP");
-			if (cp_command == nullptr || cp_command[0] == '\0') 
-				cp_command= "/bin/cp"; 
-		}
+	time_start= get_time(); 
+	++ count_jobs_exec;
 
-		/* Using '--' as an argument guarantees that the two
-		 * filenames will be interpreted as filenames and not as
-		 * options, in particular when they begin with a dash.  */
-		const char *argv[]= {cp_command,
-				     "--",
-				     source.c_str(),
-				     target.c_str(),
-				     nullptr};
+	return pid; 
+}
+
+bool Job::block_signals(sigset_t *set_old)
+{
+	sigset_t set_all;
+	if (0 != sigfillset(&set_all)) {
+		print_error_system("sigfillset"); 
+		return false; 
+	}
+	if (0 != sigprocmask(SIG_BLOCK, &set_all, set_old)) {
+		print_error_system("sigprocmask"); 
+		return false; 
+	}
+	return true; 
+}
 
-		int r= execv(cp_command, (char *const *) argv); 
+void Job::init_child()
+{
+	/* [ASYNC-SIGNAL-SAFE] We use only async signal-safe functions here */
 
-		assert(r == -1); 
-		perror("execv");
-		_Exit(127); 
+	/* The ignored signals SIGTTIN and SIGTTOU are reset by the
+	 * caller if needed */
+	struct sigaction act;
+	act.sa_handler= SIG_DFL;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags= 0; 
+	for (size_t i= 0;  i < sizeof(signals_termination) / sizeof(signals_termination[0]);  ++i) 
+		sigaction(signals_termination[i], &act, nullptr); 
+
+	/* Each child process is given, as process group ID, its
+	 * process ID.  This ensures that we can kill each child by
+	 * killing its corresponding process group ID.  This is done in
+	 * both the child and the parent.  */
+	setpgid(0, 0); 
+}
+
+pid_t Job::init_parent(pid_t pid_child, const sigset_t *set_old)
+{
+	int errno_save= errno; 
+
+	if (pid_child > 0 && 0 > setpgid(pid_child, pid_child)) {
+		/* This should only fail when the child has already quit
+		 * or called execve().  In that case we can ignore the
+		 * error, since the child has already set its process
+		 * group itself.  */ 
 	}
 
-	/* Parent execution */
-	++ count_jobs_exec;
+	if (0 != sigprocmask(SIG_SETMASK, set_old, nullptr)) {
+		perror("sigprocmask");
+		exit(ERROR_FATAL); 
+	}
 
-	assert(pid >= 1); 
-	return pid; 
+	if (pid_child < 0) {
+		errno= errno_save; 
+		print_error_system(USE_VFORK ? "vfork" : "fork"); 
+		return -1; 
+	}
+
+	return pid_child; 
 }
 
-pid_t Job::wait(int *status)
+void Job::exit_child(const char *name)
+{
+	/* [ASYNC-SIGNAL-SAFE] We use only async signal-safe functions
+	 * here, apart from strerror() which returns a constant string
+	 * because Stu does not call setlocale().  */
+	const char *message= strerror(errno); 
+	if (write(2, name, strlen(name)) >= 0 &&
+	    write(2, ": ", 2) >= 0 &&
+	    write(2, message, strlen(message)) >= 0) 
+		write_async(2, "\n");  
+	_Exit(127); 
+}
+
+pid_t Job::wait(int *status, bool block)
 /* The main loop of Stu.  We wait for the two productive signals SIGCHLD
- * and SIGUSR1.  When this function is called, there is always at least
- * one child process running.  */
+ * and SIGUSR1.  When this function is called with BLOCK set, there is
+ * always at least one child process running.  */
 {
  begin: 	
 	/* First, try wait() without blocking.  WUNTRACED is used to
 	 * also get notified when a job is suspended (e.g. with
-	 * Ctrl-Z).  */ 
-	pid_t pid= waitpid(-1, status, 
-			   WNOHANG | (option_interactive ? WUNTRACED : 0));
+	 * Ctrl-Z).  wait4() also gives us the resource usage of the
+	 * process.  */ 
+	pid_t pid= wait4(-1, status, 
+			 WNOHANG | (option_interactive ? WUNTRACED : 0),
+			 &rusage_last);
 	if (pid < 0) {
-		/* Should not happen as there is always something
-		 * running when this function is called.  However, this
-		 * may be common enough that we may want Stu to act
-		 * correctly.  */ 
-		assert(false); 
-		perror("waitpid"); 
-		abort(); 
+		/* There are no child processes when only copies are
+		 * running */
+		if (errno == ECHILD && Copy::count_running()) {
+			pid= 0;
+		} else {
+			/* Should not happen as there is always
+			 * something running when this function is
+			 * called.  However, this may be common enough
+			 * that we may want Stu to act correctly.  */ 
+			assert(false); 
+			perror("wait4"); 
+			abort(); 
+		}
 	}
 
 	if (pid > 0) {
@@ -549,6 +783,70 @@ pid_t Job::wait(int *status)
 		return pid;
 	}
 
+	/* The threads doing copies send SIGCHLD when they are done */ 
+	pid= Copy::finished(status); 
+	if (pid > 0) {
+		memset(&rusage_last, 0, sizeof(rusage_last)); 
+		return pid; 
+	}
+
+	if (! block)
+		return 0; 
+
+	if (! wait_signal())
+		return 0; 
+	goto begin; 
+}
+
+bool Job::wait_signal()
+{
+#ifdef __linux__
+	/* The productive signals are blocked, and received through a
+	 * signalfd, while the termination signals are not blocked and
+	 * their handler is called as usual while poll() waits.  Any
+	 * SIGCHLD sent after the last call to waitpid() is pending,
+	 * and makes the signalfd readable.  */ 
+	if (fd_signal < 0) {
+		fd_signal= signalfd(-1, &set_productive, SFD_NONBLOCK | SFD_CLOEXEC);
+		if (fd_signal < 0) {
+			perror("signalfd");
+			abort(); 
+		}
+	}
+
+	struct pollfd pollfd;
+	pollfd.fd= fd_signal;
+	pollfd.events= POLLIN; 
+	int ready= poll(&pollfd, 1, timeout_wait);
+	if (ready < 0) {
+		if (errno == EINTR) 
+			return true; 
+		perror("poll");
+		abort(); 
+	}
+	if (ready == 0)
+		return false; 
+
+	/* Several signals may be pending; read all of them */ 
+	struct signalfd_siginfo info[8]; 
+	ssize_t r;
+	while ((r= read(fd_signal, info, sizeof(info))) > 0) {
+		for (size_t i= 0;  i < (size_t) r / sizeof(info[0]);  ++i) {
+			if (info[i].ssi_signo == SIGUSR1) {
+				print_statistics(true); 
+				job_print_jobs(); 
+			} else {
+				/* SIGCHLD:  The caller calls waitpid() */ 
+				assert(info[i].ssi_signo == SIGCHLD); 
+			}
+		}
+	}
+	if (r < 0 && errno != EAGAIN) {
+		perror("read");
+		abort(); 
+	}
+	return true; 
+#else /* ! __linux__ */
 	/* Any SIGCHLD sent after the last call to sigwait() will be
 	 * ready for receiving, even those SIGCHLD signals received
 	 * between the last call to waitpid() and the following call to
@@ -602,10 +900,9 @@ pid_t Job::wait(int *status)
 	case SIGCHLD:
 		/* Don't act on the signal here.  We could get the PID
 		 * and STATUS from siginfo, but then the process would
-		 * stay a zombie.  Therefore, we have to call waitpid().
-		 * The call to waitpid() will then return the proper
-		 * signal.  */
-		goto begin; 
+		 * stay a zombie.  Therefore, the caller calls
+		 * waitpid().  */
+		return true; 
 
 	case SIGUSR1:
 		print_statistics(true); 
@@ -616,8 +913,9 @@ pid_t Job::wait(int *status)
 		/* We didn't wait for this signal */ 
 		assert(false);
 		fprintf(stderr, "*** sigwait: Received signal %d\n", sig);
-		goto begin; 
+		return true; 
 	}
+#endif /* ! __linux__ */
 }
 
 bool Job::waited(int status, pid_t pid_check) 
@@ -628,6 +926,10 @@ bool Job::waited(int status, pid_t pid_check)
 
 	bool success= WIFEXITED(status) && WEXITSTATUS(status) == 0;
 
+	time_end= get_time(); 
+
+	rusage= rusage_last; 
+
 	if (success)
 		++ count_jobs_success;
 	else
@@ -644,6 +946,11 @@ bool Job::waited(int status, pid_t pid_check)
 	return success; 
 }
 
+double Job::get_time()
+{
+	return get_time_monotonic(); 
+}
+
 void Job::print_statistics(bool allow_unterminated_jobs)
 {
 	/* Avoid double writing in case the destructor gets still called */ 
@@ -699,14 +1006,10 @@ void Job::handler_termination(int sig)
 	int r= sigaction(sig, &act, nullptr);
 	assert_async(r == 0); 
 
-	/* If in the child process (the short time between fork() and
-	 * exec()), just quit */ 
-	if (Job::in_child == 0) {
-		/* Terminate all processes */ 
-		job_terminate_all();
-	} else {
-		assert_async(Job::in_child == 1);
-	}
+	/* Terminate all processes.  This handler is never called in a
+	 * child process between vfork() and execve(), because the
+	 * child blocks all signals until it has reset the handlers.  */ 
+	job_terminate_all();
 
 	/* We cannot call Job::Statistics::print() here because
 	 * getrusage() is not async signal safe, and because the count_*
@@ -806,13 +1109,6 @@ void Job::init_signals()
 		perror("sigemptyset");
 		exit(ERROR_FATAL); 
 	}
-	/* These are all signals that by default would terminate the
-	 * process.  */   
-	const static int signals_termination[]= { 
-		SIGTERM, SIGINT, SIGQUIT, SIGABRT, SIGSEGV, SIGPIPE, 
-		SIGILL, SIGHUP, 
-	};
-
 	for (size_t i= 0;  i < sizeof(signals_termination) / sizeof(signals_termination[0]);  ++i) {
 		if (0 != sigaction(signals_termination[i], &act_termination, nullptr)) {
 			perror("sigaction");
@@ -880,6 +1176,157 @@ void Job::init_signals()
 		print_error_system("signal"); 
 }
 
+void Job::init_env()
+{
+	if (! env_template.empty())
+		return;
+
+	for (size_t i= 0;  envp_global[i];  ++i) {
+		const char *p= envp_global[i];
+		const char *q= p;
+		while (*q && *q != '=')  ++q;
+		env_index[string(p, q - p)]= i;
+		env_template.push_back(p); 
+	}
+	env_template.push_back("STU_STATUS=1");
+}
+
+bool Job::get_simple(const string &command,
+		     const map <string, string> &mapping,
+		     vector <string> &words,
+		     string &program)
+{
+	/* Variables that change how the shell treats the command */ 
+	if (mapping.count("PATH") || get_variable("IFS", mapping))
+		return false; 
+	if (option_individual) {
+		const char *ps4= get_variable("PS4", mapping); 
+		if (ps4 && (strchr(ps4, '$') || strchr(ps4, '`') || strchr(ps4, '\\')))
+			return false; 
+	}
+
+	size_t begin= command.find_first_not_of(" \t\n");
+	if (begin == string::npos)
+		return false;
+	size_t end= command.find_last_not_of(" \t\n") + 1; 
+
+	string word;
+	for (size_t i= begin;  i <= end;) {
+		char c= i < end ? command[i] : ' '; 
+		if (c == ' ' || c == '\t') {
+			if (word != "") {
+				words.push_back(word);
+				word= ""; 
+			}
+			++i;
+		} else if (c == '$') {
+			bool braces= i + 1 < end && command[i + 1] == '{'; 
+			size_t j= i + 1 + braces; 
+			size_t k= j;
+			while (k < end && ((command[k] >= 'a' && command[k] <= 'z') ||
+					   (command[k] >= 'A' && command[k] <= 'Z') ||
+					   command[k] == '_' ||
+					   (k > j && command[k] >= '0' && command[k] <= '9')))
+				++k;
+			if (k == j)
+				return false;
+			if (braces) {
+				if (k == end || command[k] != '}')
+					return false;
+				i= k + 1;
+			} else {
+				i= k;
+			}
+			const char *value= get_variable(command.substr(j, k - j).c_str(), mapping); 
+			/* Empty values would remove words */ 
+			if (value == nullptr || *value == '\0')
+				return false;
+			for (const char *p= value;  *p;  ++p) {
+				if (! is_simple_char(*p))
+					return false;
+			}
+			word += value; 
+		} else if (is_simple_char(c)) {
+			/* '=' in the first word is an assignment */ 
+			if (c == '=' && words.empty())
+				return false; 
+			word += c;
+			++i;
+		} else {
+			return false; 
+		}
+	}
+	assert(! words.empty()); 
+
+	if (words[0].find('/') != string::npos) {
+		program= words[0];
+		return true;
+	}
+
+	/* Special builtins, regular builtins, and reserved words of
+	 * POSIX shells and of shells commonly installed as /bin/sh */
+	static const char *const builtins[]= {
+		".", ":", "[", "[[", "alias", "bg", "break", "builtin",
+		"case", "cd", "command", "continue", "declare", "do",
+		"done", "echo", "elif", "else", "enable", "esac", "eval",
+		"exec", "exit", "export", "false", "fc", "fg", "fi",
+		"for", "function", "getopts", "hash", "if", "in", "jobs",
+		"kill", "let", "local", "printf", "pwd", "read",
+		"readonly", "return", "select", "set", "shift", "source",
+		"test", "then", "time", "times", "trap", "true", "type",
+		"typeset", "ulimit", "umask", "unalias", "unset", "until",
+		"wait", "while", 
+	};
+	for (const char *builtin:  builtins) {
+		if (words[0] == builtin)
+			return false;
+	}
+
+	auto i= programs.find(words[0]); 
+	if (i == programs.end()) {
+		/* Search $PATH like the shell does */ 
+		string found; 
+		const char *path= get_variable("PATH", mapping); 
+		while (path) {
+			const char *colon= strchr(path, ':'); 
+			string dir= colon ? string(path, colon - path) : string(path); 
+			if (dir == "")
+				dir= ".";
+			string filename= dir + '/' + words[0]; 
+			struct stat buf;
+			if (stat(filename.c_str(), &buf) == 0 && S_ISREG(buf.st_mode) &&
+			    access(filename.c_str(), X_OK) == 0) {
+				found= filename;
+				break;
+			}
+			path= colon ? colon + 1 : nullptr; 
+		}
+		i= programs.emplace(words[0], found).first; 
+	}
+	program= i->second;
+	return program != ""; 
+}
+
+const char *Job::get_variable(const char *name, 
+			      const map <string, string> &mapping)
+{
+	auto i= mapping.find(name); 
+	if (i != mapping.end())
+		return i->second.c_str();
+	init_env(); 
+	auto j= env_index.find(name); 
+	if (j == env_index.end())
+		return nullptr;
+	return strchr(env_template[j->second], '=') + 1; 
+}
+
+bool Job::is_simple_char(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		(c >= '0' && c <= '9') || (c && strchr("_-./,:@%+=", c)) ||
+		(unsigned char) c >= 0x80;
+}
+
 void Job::kill(pid_t pid)
 /* Passing (-pid) to kill() kills the whole process group with PGID
  * (pid).  Since we set each child process to have its PID as its
@@ -892,6 +1339,11 @@ void Job::kill(pid_t pid)
 
 	assert_async(pid > 1); 
 
+	/* Copies done by Stu itself are not processes; they are stopped
+	 * all at once by Copy::cancel() */ 
+	if (Copy::is_copy(pid))
+		return; 
+
 	/* We send first SIGTERM, then SIGCONT */ 
 	
 	if (0 > ::kill(-pid, SIGTERM)) {
@@ -0,0 +1,163 @@
+#ifndef MANIFEST_HH
+#define MANIFEST_HH
+
+/*
+ * The manifest of a null build, used with the -N option.  When Stu
+ * finds all targets to be up to date without running any command, it
+ * writes the manifest file, which contains:
+ *
+ *    - a key, i.e., a hash of Stu's arguments, of $STU_OPTIONS, of the
+ *      working directory, and of all Stu source code (see
+ *      Tokenizer::hash_source);
+ *    - the result of stat() for every file Stu has checked, i.e., the
+ *      modification time and size, or the fact that the file does not
+ *      exist.
+ *
+ * On the next invocation with the same manifest file, the key is
+ * recomputed and all listed files are probed again in one batch.  When
+ * nothing differs, the outcome would be the same null build, and Stu
+ * prints "Targets are up to date" without building the execution
+ * graph.  On any difference, Stu falls back to the normal procedure.
+ *
+ * FORMAT:  A state file (see state.hh) whose header contains the
+ * version of Stu.  The first field is the key in hexadecimal, followed
+ * by pairs of filename and state.  The state is either "TIMESTAMP SIZE",
+ * with TIMESTAMP as output by Timestamp::format(), or "- ERRNO" when
+ * stat() failed.
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "state.hh"
+
+class Manifest
+{
+public:
+	static const char *filename;
+	/* Set by the -N option; null when not used */
+
+	static vector <string> args;
+	/* The arguments of Stu, in their original order, i.e., before
+	 * getopt() may have reordered them */
+
+	static bool check();
+	/* Whether the manifest file exists and matches the current
+	 * state, in which case the targets are up to date.  Must be
+	 * called after all Stu source code was read.  */
+
+	static void write();
+	/* Write the manifest file from the files probed during the
+	 * build.  Must be called only when the build was successful.
+	 * Does nothing when a command was run, or when a file has a
+	 * timestamp that is not older than Stu startup, because such a
+	 * file could be changed again without its timestamp changing.  */
+
+private:
+	static const char *const header;
+
+	static string get_key();
+	/* Empty on error */
+
+	static string format_state(const Probe::Result &result);
+};
+
+const char *Manifest::filename= nullptr;
+vector <string> Manifest::args;
+const char *const Manifest::header= "stu " STU_VERSION;
+
+bool Manifest::check()
+{
+	assert(filename);
+
+	string key= get_key();
+	if (key == "")
+		return false;
+
+	vector <string> fields;
+	if (! read_state(filename, header, fields))
+		return false;
+	if (fields.size() % 2 != 1 || fields[0] != key)
+		return false;
+
+	vector <string> filenames;
+	for (size_t i= 1;  i < fields.size();  i += 2)
+		filenames.push_back(fields[i]);
+	Probe::probe(filenames);
+
+	for (size_t i= 1;  i < fields.size();  i += 2) {
+		Probe::Result result;
+		result.ret= Probe::stat(fields[i].c_str(), &result.buf);
+		result.errno_stat= result.ret == 0 ? 0 : errno;
+		if (format_state(result) != fields[i + 1])
+			return false;
+	}
+
+	return true;
+}
+
+void Manifest::write()
+{
+	assert(filename);
+
+	if (Probe::get_changed())
+		return;
+
+	string key= get_key();
+	if (key == "")
+		return;
+
+	vector <string> filenames;
+	for (const auto &i:  Probe::get_results()) {
+		struct stat buf= i.second.buf;
+		if (i.second.ret == 0 && ! (Timestamp(&buf) < Timestamp::startup))
+			return;
+		filenames.push_back(i.first);
+	}
+	sort(filenames.begin(), filenames.end());
+
+	vector <string> fields;
+	fields.push_back(key);
+	for (const string &f:  filenames) {
+		fields.push_back(f);
+		fields.push_back(format_state(Probe::get_results().at(f)));
+	}
+	write_state(filename, header, fields, 'N');
+}
+
+string Manifest::get_key()
+{
+	char *cwd= getcwd(nullptr, 0);
+	if (cwd == nullptr)
+		return "";
+
+	string text= cwd;
+	free(cwd);
+	text += '\0';
+	const char *stu_options= getenv("STU_OPTIONS");
+	if (stu_options)
+		text += stu_options;
+	text += '\0';
+	for (const string &arg:  args)
+		text += arg + '\0';
+
+	/* FNV-1a, continuing from the hash of the source code */
+	uint64_t hash= Tokenizer::hash_source;
+	for (char c:  text) {
+		hash ^= (unsigned char) c;
+		hash *= 0x100000001b3;
+	}
+
+	return frmt("%016jx", (uintmax_t) hash);
+}
+
+string Manifest::format_state(const Probe::Result &result)
+{
+	if (result.ret != 0)
+		return frmt("- %d", result.errno_stat);
+
+	struct stat buf= result.buf;
+	return format_file_state(&buf);
+}
+
+#endif /* ! MANIFEST_HH */
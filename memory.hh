@@ -0,0 +1,159 @@
+#ifndef MEMORY_HH
+#define MEMORY_HH
+
+/*
+ * The memory budget, used with the -B option.  Each job is assumed to
+ * use as much memory as the largest peak resident set size of the jobs
+ * of its rule, as recorded in the history file given by -T (see
+ * history.hh).  A job is only started when the sum of these estimates
+ * over the running jobs, including the new job, fits into the budget.
+ * Meanwhile, Stu continues to start other jobs, in particular jobs with
+ * a smaller estimate.  Thus, jobs that need much memory can be run in
+ * parallel to light jobs without the system running out of memory.
+ *
+ * Jobs of rules for which nothing is recorded are not counted.  A job
+ * whose estimate is larger than the budget is started when no other
+ * counted job is running, such that the build always progresses.
+ *
+ * The budget is given either as a size, or as "avail" to use the memory
+ * available at the start of the build, as given by MemAvailable in
+ * /proc/meminfo on Linux.
+ */
+
+class Memory
+{
+public:
+	static long budget;
+	/* In kilobytes; zero when the -B option is not used */
+
+	static string parse(const char *text);
+	/* Set the budget from the argument of the -B option.  Return ""
+	 * on success, or else an error message.  */
+
+	static bool fits(long estimate);
+	/* Whether a job with the given estimate in kilobytes can be
+	 * started now */
+
+	static void reserve(long estimate);
+	/* Reserve memory for a job that is about to be started */
+
+	static void release(long estimate);
+	/* Return the memory reserved for a job that has finished */
+
+	static void add_waiting(double time);
+	/* Count a job that had to wait for memory during the given
+	 * number of seconds */
+
+	static void print_statistics();
+	/* Print the reserved memory and the waiting time, regardless of
+	 * OPTION_STATISTICS.  Nothing is printed when the budget is not
+	 * used.  */
+
+private:
+	static long used;
+	/* Sum of the estimates of the running jobs, in kilobytes */
+
+	static long used_max;
+
+	static size_t count_waiting;
+	/* Number of jobs that had to wait for memory */
+
+	static double time_waiting;
+	/* Sum of the times during which jobs waited, in seconds */
+
+	static long read_available();
+	/* The value of MemAvailable in kilobytes, or -1 on error */
+};
+
+long Memory::budget= 0;
+long Memory::used= 0;
+long Memory::used_max= 0;
+size_t Memory::count_waiting= 0;
+double Memory::time_waiting= 0;
+
+string Memory::parse(const char *text)
+{
+	const string message= fmt("expected a size such as %s or %s, or %s, not %s",
+				  name_format_err("512M"), name_format_err("8G"),
+				  name_format_err("avail"), name_format_err(text));
+
+	if (! strcmp(text, "avail")) {
+		budget= read_available();
+		if (budget <= 0) {
+			budget= 0;
+			return fmt("%s cannot be read from %s",
+				   name_format_err("MemAvailable"),
+				   name_format_err("/proc/meminfo"));
+		}
+		return "";
+	}
+
+	errno= 0;
+	char *endptr;
+	double size= strtod(text, &endptr);
+	if (errno != 0 || endptr == text || ! (size > 0))
+		return message;
+	switch (*endptr) {
+	default:  return message;
+	case 'k':  case 'K':  break;
+	case 'm':  case 'M':  size *= 1024;  break;
+	case 'g':  case 'G':  size *= 1024 * 1024;  break;
+	case 't':  case 'T':  size *= 1024.0 * 1024 * 1024;  break;
+	}
+	if (endptr[1] != '\0' || size >= (double) LONG_MAX)
+		return message;
+	budget= size < 1 ? 1 : (long) size;
+	return "";
+}
+
+bool Memory::fits(long estimate)
+{
+	assert(budget > 0);
+	assert(estimate >= 0);
+	return used == 0 || used + estimate <= budget;
+}
+
+void Memory::reserve(long estimate)
+{
+	assert(fits(estimate));
+	used += estimate;
+	used_max= max(used_max, used);
+}
+
+void Memory::release(long estimate)
+{
+	assert(estimate <= used);
+	used -= estimate;
+}
+
+void Memory::add_waiting(double time)
+{
+	++count_waiting;
+	time_waiting += time;
+}
+
+void Memory::print_statistics()
+{
+	if (budget == 0)
+		return;
+	printf("STATISTICS  memory:  budget = %ld kB, largest reserved = %ld kB, "
+	       "jobs waiting = %zu, waiting time = %.3f s\n",
+	       budget, used_max, count_waiting, time_waiting);
+}
+
+long Memory::read_available()
+{
+	FILE *file= fopen("/proc/meminfo", "r");
+	if (file == nullptr)
+		return -1;
+	char line[0x100];
+	long available= -1;
+	while (fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "MemAvailable: %ld kB", &available) == 1)
+			break;
+	}
+	fclose(file);
+	return available;
+}
+
+#endif /* ! MEMORY_HH */
@@ -34,6 +34,9 @@ static bool option_no_delete= false;
 static bool option_print= false;
 /* The -P option (print rules) */
 
+static bool option_progress= false;
+/* The -G option (output progress) */
+
 static bool option_question= false; 
 /* The -q option (question mode) */
 
@@ -43,12 +46,16 @@ static bool option_silent= false;
 static bool option_individual= false;
 /* The -x option (use sh -x) */ 
 
+static bool option_watch= false;
+/* The -w option (watch mode) */
+
 static bool option_statistics= false;
 /* The -z option (output statistics) */
 
 enum class Order {
-	DFS   = 0,
-	RANDOM= 1,
+	DFS     = 0,
+	RANDOM  = 1,
+	CRITICAL= 2,
 	
 	/* -M mode is coded as Order::RANDOM */ 
 };
@@ -231,6 +231,58 @@ shared_ptr <Rule> Parser::parse_rule(shared_ptr <const Place_Param_Target> &targ
 
 	vector <shared_ptr <const Place_Param_Target> > place_param_targets; 
 
+	Place place_restat;
+	/* Place of the -r flag; empty when not used */
+
+	Place place_pool;
+	Pool *pool= nullptr; 
+	/* Place of the -u flag and the given pool; empty and null when
+	 * not used */
+
+	Place place_flag_last;
+	char flag_last= '\0'; 
+	/* Place and character of the last of these flags */ 
+
+	while (is_flag('r') || is_flag('u')) {
+		place_flag_last= (*iter)->get_place(); 
+		flag_last= is <Flag_Token> ()->flag; 
+		if (is_flag('r')) {
+			place_restat= (*iter)->get_place();
+			++iter;
+			continue;
+		}
+
+		place_pool= (*iter)->get_place();
+		++iter;
+		if (! is <Name_Token> ()) {
+			if (iter == tokens.end()) 
+				place_end << "expected the name of a pool";
+			else
+				(*iter)->get_place_start() <<
+					fmt("expected the name of a pool, not %s",
+					    (*iter)->format_start_err());
+			place_pool << fmt("after flag %s",
+					  multichar_format_err("-u")); 
+			throw ERROR_LOGICAL;
+		}
+		shared_ptr <Name_Token> name_pool= is <Name_Token> (); 
+		if (name_pool->get_n() != 0) {
+			name_pool->get_place() <<
+				fmt("name of pool %s must not be parametrized",
+				    name_pool->format_err());
+			throw ERROR_LOGICAL;
+		}
+		pool= Pool::get(name_pool->unparametrized()); 
+		if (pool == nullptr) {
+			name_pool->get_place() <<
+				fmt("pool %s must be declared using %s%%pool%s",
+				    name_pool->format_err(),
+				    Color::word, Color::end); 
+			throw ERROR_LOGICAL;
+		}
+		++iter;
+	}
+
 	while (iter != tokens.end()) {
 
 		Place place_output_new; 
@@ -357,6 +409,17 @@ shared_ptr <Rule> Parser::parse_rule(shared_ptr <const Place_Param_Target> &targ
 	}
 
 	if (place_param_targets.size() == 0) {
+		if (! place_flag_last.empty()) {
+			if (iter == tokens.end()) 
+				place_end << "expected a target";
+			else
+				(*iter)->get_place_start() <<
+					fmt("expected a target, not %s",
+					    (*iter)->format_start_err());
+			place_flag_last << fmt("after flag %s",
+					       multichar_format_err(frmt("-%c", flag_last))); 
+			throw ERROR_LOGICAL;
+		}
 		assert(iter == iter_begin); 
 		return nullptr; 
 	}
@@ -508,6 +571,28 @@ shared_ptr <Rule> Parser::parse_rule(shared_ptr <const Place_Param_Target> &targ
 				}
 			}
 
+			if (! place_restat.empty()) {
+				place_restat << 
+					fmt("flag %s must not be used",
+					    multichar_format_err("-r")); 
+				place_equal << 
+					fmt("in copy rule using %s for target %s", 
+					    char_format_err('='),
+					    place_param_targets[0]->format_err()); 
+				throw ERROR_LOGICAL;
+			}
+
+			if (! place_pool.empty()) {
+				place_pool << 
+					fmt("flag %s must not be used",
+					    multichar_format_err("-u")); 
+				place_equal << 
+					fmt("in copy rule using %s for target %s", 
+					    char_format_err('='),
+					    place_param_targets[0]->format_err()); 
+				throw ERROR_LOGICAL;
+			}
+
 			if (! is <Name_Token> ()) {
 				if (iter == tokens.end()) {
 					(*iter)->get_place_start() << 
@@ -659,6 +744,54 @@ shared_ptr <Rule> Parser::parse_rule(shared_ptr <const Place_Param_Target> &targ
 		}
 	}
 
+	/* Cases where the -r flag is not possible */ 
+	if (! place_restat.empty()) {
+		if (command == nullptr) {
+			place_restat <<
+				fmt("flag %s must not be used",
+				    multichar_format_err("-r")); 
+			place_nocommand <<
+				fmt("in rule for %s without a command",
+				    place_param_targets[0]->format_err());
+			throw ERROR_LOGICAL;
+		}
+
+		if (is_hardcode) {
+			place_restat <<
+				fmt("flag %s must not be used",
+				    multichar_format_err("-r")); 
+			place_equal <<
+				fmt("in rule for %s with assigned content using %s",
+				    place_param_targets[0]->format_err(),
+				    char_format_err('=')); 
+			throw ERROR_LOGICAL;
+		}
+	}
+
+	/* Cases where the -u flag is not possible */ 
+	if (! place_pool.empty()) {
+		if (command == nullptr) {
+			place_pool <<
+				fmt("flag %s must not be used",
+				    multichar_format_err("-u")); 
+			place_nocommand <<
+				fmt("in rule for %s without a command",
+				    place_param_targets[0]->format_err());
+			throw ERROR_LOGICAL;
+		}
+
+		if (is_hardcode) {
+			place_pool <<
+				fmt("flag %s must not be used",
+				    multichar_format_err("-u")); 
+			place_equal <<
+				fmt("in rule for %s with assigned content using %s",
+				    place_param_targets[0]->format_err(),
+				    char_format_err('=')); 
+			throw ERROR_LOGICAL;
+		}
+	}
+
 	/* Cases where input redirection is not possible */ 
 	if (! filename_input.empty()) {
 		if (command == nullptr) {
@@ -679,7 +812,9 @@ shared_ptr <Rule> Parser::parse_rule(shared_ptr <const Place_Param_Target> &targ
 		 deps, 
 		 command, is_hardcode, 
 		 redirect_index,
-		 filename_input);
+		 filename_input,
+		 place_restat,
+		 pool);
 }
 
 bool Parser::parse_expression_list(vector <shared_ptr <const Dep> > &ret, 
@@ -837,6 +972,16 @@ bool Parser::parse_expression(shared_ptr <const Dep> &ret,
 	if (is <Flag_Token> ()) {
 		const Flag_Token &flag_token= *is <Flag_Token> (); 
  		const Place place_flag= (*iter)->get_place();
+
+		/* The -r and -u flags apply to rules, not to dependencies */ 
+		if (flag_token.flag == 'r' || flag_token.flag == 'u') {
+			place_flag << 
+				fmt("flag %s must not be used in a dependency",
+				    multichar_format_err(frmt("-%c", flag_token.flag))); 
+			explain_flags(); 
+			throw ERROR_LOGICAL;
+		}
+
 		const unsigned i_flag= flag_get_index(flag_token.flag); 
  		++iter; 
 
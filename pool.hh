@@ -0,0 +1,134 @@
+#ifndef POOL_HH
+#define POOL_HH
+
+/*
+ * Pools limit the number of jobs that are run at the same time for a
+ * given set of rules, in addition to the global limit given by the -j
+ * option.  A pool is declared in the Stu script with the directive
+ *
+ *	%pool NAME CAPACITY
+ *
+ * and a rule is assigned to it with the flag -u placed before its
+ * targets:
+ *
+ *	-u NAME TARGET ... : DEPENDENCY ... { COMMAND }
+ *
+ * A job of such a rule is only started when fewer than CAPACITY jobs of
+ * the pool are running.  Meanwhile, Stu continues to start jobs of other
+ * rules.  Thus, memory-hungry jobs can be limited to a few at a time,
+ * while many light jobs run in parallel to them.
+ */
+
+class Pool
+{
+public:
+	const string name;
+
+	const size_t capacity;
+	/* Positive */
+
+	const Place place;
+	/* Where the pool is declared */
+
+	static void declare(const string &name, size_t capacity,
+			    const Place &place);
+	/* Declare a pool.  Throw a logical error when a pool with the
+	 * same name was already declared.  */
+
+	static Pool *get(const string &name);
+	/* The pool with the given name, or null when it is not declared */
+
+	bool acquire();
+	/* Take a slot for a job that is about to be started.  Return
+	 * false when all slots are in use.  */
+
+	void add_waiting(double time);
+	/* Count a job that had to wait for a slot during the given
+	 * number of seconds */
+
+	void release();
+	/* Return the slot of a job that has finished */
+
+	static void print_statistics();
+	/* Print the number of jobs and the waiting time of each pool,
+	 * regardless of OPTION_STATISTICS */
+
+private:
+	size_t count_running;
+	/* Number of jobs in the pool that are currently running */
+
+	size_t count_jobs;
+	/* Number of jobs started in the pool */
+
+	size_t count_waiting;
+	/* Number of jobs that had to wait for a slot */
+
+	double time_waiting;
+	/* Sum of the times during which jobs waited for a slot, in
+	 * seconds */
+
+	static map <string, Pool *> pools;
+	/* Never deleted */
+
+	Pool(const string &name_, size_t capacity_, const Place &place_)
+		:  name(name_), capacity(capacity_), place(place_),
+		   count_running(0), count_jobs(0), count_waiting(0),
+		   time_waiting(0)
+	{  }
+};
+
+map <string, Pool *> Pool::pools;
+
+void Pool::declare(const string &name, size_t capacity,
+		   const Place &place)
+{
+	assert(capacity > 0);
+	auto i= pools.find(name);
+	if (i != pools.end()) {
+		place << fmt("pool %s must not be declared twice",
+			     name_format_err(name));
+		i->second->place << "previous declaration";
+		throw ERROR_LOGICAL;
+	}
+	pools[name]= new Pool(name, capacity, place);
+}
+
+Pool *Pool::get(const string &name)
+{
+	auto i= pools.find(name);
+	return i == pools.end() ? nullptr : i->second;
+}
+
+bool Pool::acquire()
+{
+	if (count_running == capacity)
+		return false;
+	++count_running;
+	++count_jobs;
+	return true;
+}
+
+void Pool::add_waiting(double time)
+{
+	++count_waiting;
+	time_waiting += time;
+}
+
+void Pool::release()
+{
+	assert(count_running > 0);
+	--count_running;
+}
+
+void Pool::print_statistics()
+{
+	for (const auto &i:  pools) {
+		const Pool *pool= i.second;
+		printf("STATISTICS  pool %s:  capacity = %zu, jobs = %zu, "
+		       "jobs waiting = %zu, waiting time = %.3f s\n",
+		       pool->name.c_str(), pool->capacity, pool->count_jobs,
+		       pool->count_waiting, pool->time_waiting);
+	}
+}
+
+#endif /* ! POOL_HH */
@@ -0,0 +1,334 @@
+#ifndef PROBE_HH
+#define PROBE_HH
+
+/*
+ * Cached and concurrent probing of files with stat().  All calls to
+ * stat() for file targets go through Probe::stat(), which keeps the
+ * result for each filename, such that each file is only probed once
+ * no matter how many executions check it.  The result for a file is
+ * kept until invalidate() is called for it, which must be done whenever
+ * Stu may have changed that file, i.e., when Stu removes or writes the
+ * file itself, and for the targets of a job when it has finished.
+ * Commands may also create files that are not their targets, i.e.,
+ * files declared without a command.  Therefore, each result records
+ * the number of finished jobs when it was obtained, and a result for
+ * such a file is not used when a job has finished since.
+ *
+ * When many files have to be checked at once, e.g., all source files
+ * on which a target depends, calling stat() on them one after the
+ * other is slow on networked filesystems, because each call waits for
+ * a full round trip.  Instead, the files are passed to Probe::probe()
+ * together, which calls stat() on all of them concurrently using a
+ * small pool of threads.
+ *
+ * The threads only ever call stat() and wait for work, and are idle
+ * whenever the main thread does anything else, in particular when it
+ * calls fork().  All signals are blocked in them, such that signals are
+ * handled by the main thread as before.
+ */
+
+#include <signal.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+class Probe
+{
+public:
+	struct Result
+	{
+		int ret;
+		int errno_stat;
+		struct stat buf;
+		size_t generation;
+		/* Value of GENERATION when the result was obtained */
+	};
+
+	static void probe(const vector <string> &filenames);
+	/* Call stat() on all given files concurrently, and keep the
+	 * results.  Files whose result is already known are skipped.
+	 * Does nothing when there are too few files to make the use of
+	 * threads worthwhile.  */
+
+	static int stat(const char *filename, struct stat *buf,
+			bool after_jobs= false);
+	/* Same semantics as stat(), but use the known result for the
+	 * file if available.  Sets ERRNO as stat() does.  With
+	 * AFTER_JOBS, the known result is only used when no job has
+	 * finished since it was obtained; this is used for files that
+	 * commands may create without them being their targets.  */
+
+	static void invalidate(const char *filename);
+	/* Forget the result for the given file */
+
+	static void finished_job() {
+		++generation;
+		changed= true;
+	}
+	/* A job has finished.  The results for its targets must be
+	 * forgotten separately.  */
+
+	static void set(const string &filename, const Result &result);
+	/* Set the result for the given file, as obtained elsewhere, e.g.,
+	 * by another process */
+
+	static void print_statistics();
+	/* Print the number of stat() calls done and saved, regardless
+	 * of OPTION_STATISTICS */
+
+	static const unordered_map <string, Result> &get_results() {
+		return results;
+	}
+
+	static bool get_changed() {  return changed;  }
+	/* Whether any result was forgotten, i.e., whether Stu may have
+	 * changed any file */
+
+	static bool keep_filenames;
+	/* Whether to keep the names of probed and invalidated files in
+	 * FILENAMES_TOUCHED.  Set by watch mode.  */
+
+	static vector <string> filenames_touched;
+	/* The names of the files that were probed or whose result was
+	 * forgotten since watch mode last took them, possibly more than
+	 * once.  Only filled when KEEP_FILENAMES is set.  */
+
+private:
+	static const size_t count_threads= 8;
+	/* Number of threads.  They are mostly waiting for the
+	 * filesystem, and therefore this does not depend on the number
+	 * of processors.  */
+
+	static const size_t size_min= 4;
+	/* Minimal number of files for which threads are used */
+
+	static unordered_map <string, Result> results;
+
+	static bool changed;
+
+	static size_t generation;
+	/* Number of finished jobs */
+
+	static size_t count_stat, count_saved;
+	/* Number of calls to stat() that were done and that were
+	 * avoided by using a known result, respectively */
+
+	struct Batch
+	/* The state shared with the threads.  Never deleted, because
+	 * the threads may still be waiting on it when the program
+	 * exits.  */
+	{
+		vector <const char *> filenames;
+		vector <Result> results;
+		/* The current batch, with parallel indexes */
+
+		atomic <size_t> next;
+		/* Next index in FILENAMES to be probed */
+
+		size_t done= 0;
+		/* Number of files in the current batch that were probed */
+
+		size_t count_active= 0;
+		/* Number of threads currently in work().  The batch is
+		 * only changed when this is zero.  */
+
+		unsigned long generation= 0;
+		/* Incremented for each new batch, so that threads
+		 * recognize that there is new work */
+
+		mutex m;
+		condition_variable cond_work, cond_finished;
+		/* Protect DONE, COUNT_ACTIVE and GENERATION, as well as
+		 * changes to the batch */
+
+		Batch()
+			:  next(0)
+		{  }
+	};
+
+	static Batch *batch;
+	/* Null when the threads were not started yet */
+
+	static void start_threads();
+	static void run_thread();
+	static void work();
+	/* Probe files of the current batch until none are left */
+};
+
+unordered_map <string, Probe::Result> Probe::results;
+bool Probe::changed= false;
+size_t Probe::generation= 0;
+size_t Probe::count_stat= 0;
+size_t Probe::count_saved= 0;
+Probe::Batch *Probe::batch= nullptr;
+bool Probe::keep_filenames= false;
+vector <string> Probe::filenames_touched;
+
+void Probe::probe(const vector <string> &filenames)
+{
+	vector <string> filenames_new;
+	for (const string &filename:  filenames) {
+		if (! results.count(filename))
+			filenames_new.push_back(filename);
+	}
+	if (filenames_new.size() < size_min)
+		return;
+
+	start_threads();
+
+	{
+		unique_lock <mutex> lock(batch->m);
+		while (batch->count_active != 0)
+			batch->cond_finished.wait(lock);
+		batch->filenames.resize(filenames_new.size());
+		for (size_t i= 0;  i < filenames_new.size();  ++i)
+			batch->filenames[i]= filenames_new[i].c_str();
+		batch->results.resize(filenames_new.size());
+		batch->next= 0;
+		batch->done= 0;
+		++batch->generation;
+	}
+	batch->cond_work.notify_all();
+
+	/* The main thread works on the batch as well */
+	work();
+
+	{
+		unique_lock <mutex> lock(batch->m);
+		while (batch->done < batch->filenames.size())
+			batch->cond_finished.wait(lock);
+	}
+
+	for (size_t i= 0;  i < filenames_new.size();  ++i) {
+		batch->results[i].generation= generation;
+		results[filenames_new[i]]= batch->results[i];
+	}
+	count_stat += filenames_new.size();
+	Counters::add(Counters::C_STAT, filenames_new.size()); 
+	if (keep_filenames)
+		filenames_touched.insert(filenames_touched.end(),
+					 filenames_new.begin(), filenames_new.end());
+}
+
+int Probe::stat(const char *filename, struct stat *buf, bool after_jobs)
+{
+	auto i= results.find(filename);
+	if (i == results.end() ||
+	    (after_jobs && i->second.generation != generation)) {
+		Result result;
+		result.ret= ::stat(filename, &result.buf);
+		result.errno_stat= result.ret == 0 ? 0 : errno;
+		result.generation= generation;
+		++count_stat;
+		Counters::add(Counters::C_STAT); 
+		if (i == results.end())
+			i= results.emplace(filename, result).first;
+		else
+			i->second= result;
+		if (keep_filenames)
+			filenames_touched.push_back(filename);
+	} else {
+		++count_saved;
+	}
+
+	*buf= i->second.buf;
+	errno= i->second.errno_stat;
+	return i->second.ret;
+}
+
+void Probe::invalidate(const char *filename)
+{
+	results.erase(filename);
+	changed= true;
+	if (keep_filenames)
+		filenames_touched.push_back(filename);
+}
+
+void Probe::set(const string &filename, const Result &result)
+{
+	Result &r= results[filename];
+	r= result;
+	r.generation= generation;
+}
+
+void Probe::print_statistics()
+{
+	printf("STATISTICS  stat calls = %zu (%zu saved)\n",
+	       count_stat, count_saved);
+}
+
+void Probe::start_threads()
+{
+	if (batch)
+		return;
+	batch= new Batch;
+
+	/* Threads inherit the signal mask */
+	sigset_t set_all, set_old;
+	sigfillset(&set_all);
+	if (0 != pthread_sigmask(SIG_BLOCK, &set_all, &set_old)) {
+		perror("pthread_sigmask");
+		exit(ERROR_FATAL);
+	}
+
+	for (size_t i= 0;  i < count_threads;  ++i) {
+		thread t(run_thread);
+		t.detach();
+	}
+
+	if (0 != pthread_sigmask(SIG_SETMASK, &set_old, nullptr)) {
+		perror("pthread_sigmask");
+		exit(ERROR_FATAL);
+	}
+}
+
+void Probe::run_thread()
+{
+	unsigned long generation_done= 0;
+	while (true) {
+		{
+			unique_lock <mutex> lock(batch->m);
+			while (batch->generation == generation_done)
+				batch->cond_work.wait(lock);
+			generation_done= batch->generation;
+			++batch->count_active;
+		}
+		work();
+		{
+			unique_lock <mutex> lock(batch->m);
+			--batch->count_active;
+		}
+		batch->cond_finished.notify_all();
+	}
+}
+
+void Probe::work()
+{
+	size_t count= 0;
+	size_t i;
+	while ((i= batch->next++) < batch->filenames.size()) {
+		Result &result= batch->results[i];
+		result.ret= ::stat(batch->filenames[i], &result.buf);
+		result.errno_stat= result.ret == 0 ? 0 : errno;
+		++count;
+	}
+
+	if (count == 0)
+		return;
+
+	bool finished;
+	{
+		unique_lock <mutex> lock(batch->m);
+		batch->done += count;
+		finished= batch->done == batch->filenames.size();
+	}
+	if (finished)
+		batch->cond_finished.notify_all();
+}
+
+#endif /* ! PROBE_HH */
@@ -0,0 +1,225 @@
+#ifndef PROGRESS_HH
+#define PROGRESS_HH
+
+/*
+ * The progress of the build, output as a line on standard output with
+ * the -G option, and written to a status file with the -S option.  Both
+ * are only updated when a job has finished, and at most once per
+ * interval, such that the main loop is not slowed down.
+ *
+ * The remaining jobs are those of the executions that are known so far
+ * and have a command, but whose job was not started.  Some of them may
+ * turn out to be up to date, and executions that are not yet known are
+ * not counted.  The estimated time of arrival (ETA) uses the durations
+ * recorded with -T (see history.hh):  the sum of the remaining
+ * durations of the running jobs and of the recorded durations of the
+ * remaining jobs, divided by the number of parallel jobs, but at least
+ * the longest remaining duration of a running job.  Jobs without a
+ * recorded duration are not included in the estimate.
+ */
+
+class Progress
+{
+public:
+	static const char *filename;
+	/* Set by the -S option; null when not used */
+
+	struct Running
+	{
+		string target;
+		double time_elapsed;
+		double time_remaining;
+		/* Zero when no duration is recorded */
+	};
+
+	static bool enabled() {
+		return option_progress || filename;
+	}
+
+	static void init(long jobs_);
+	/* Called when the build starts, with the maximal number of
+	 * parallel jobs */
+
+	static void add_pending(double duration);
+	/* An execution which may have to run a job has been created.
+	 * DURATION is the recorded duration of its job, or zero.  */
+
+	static void remove_pending(double duration);
+	/* The job of the execution has been started, or the execution is
+	 * finished without a job */
+
+	static void add_finished() {  ++count_finished;  }
+
+	static bool due();
+	/* Whether an update is due now */
+
+	static void update(vector <Running> &running);
+	/* Output the progress and write the status file, given the
+	 * running jobs.  Must only be called when due() is true.  */
+
+	static void close();
+	/* Write the status file a last time, if used */
+
+private:
+	static const double interval;
+	/* Minimal time between two updates, in seconds */
+
+	static const size_t count_top= 3;
+	/* Number of longest-running jobs in the status line */
+
+	static long jobs;
+	static size_t count_pending, count_finished;
+	static double duration_pending;
+	/* Sum of the recorded durations of pending jobs */
+	static double time_last;
+	/* Time of the last update, as returned by Job::get_time(); zero
+	 * before the first update */
+	static bool warned;
+	/* Whether a warning about the status file was output */
+
+	static double get_eta(const vector <Running> &running);
+	/* In seconds; negative when nothing is recorded */
+
+	static string format_duration(double duration);
+	/* As [H:]MM:SS */
+
+	static void write(const vector <Running> &running, bool done);
+};
+
+const char *Progress::filename= nullptr;
+const double Progress::interval= 1.0;
+long Progress::jobs= 1;
+size_t Progress::count_pending= 0;
+size_t Progress::count_finished= 0;
+double Progress::duration_pending= 0;
+double Progress::time_last= 0;
+bool Progress::warned= false;
+
+void Progress::init(long jobs_)
+{
+	assert(jobs_ >= 1);
+	jobs= jobs_;
+}
+
+void Progress::add_pending(double duration)
+{
+	assert(enabled());
+	++count_pending;
+	duration_pending += duration;
+}
+
+void Progress::remove_pending(double duration)
+{
+	assert(count_pending > 0);
+	--count_pending;
+	duration_pending -= duration;
+	if (count_pending == 0)
+		duration_pending= 0;
+}
+
+bool Progress::due()
+{
+	double time= Job::get_time();
+	if (time_last != 0 && time - time_last < interval)
+		return false;
+	time_last= time;
+	return true;
+}
+
+void Progress::update(vector <Running> &running)
+{
+	sort(running.begin(), running.end(),
+	     [](const Running &a, const Running &b) {
+		     return a.time_elapsed > b.time_elapsed;
+	     });
+
+	if (option_progress) {
+		double eta= get_eta(running);
+		string text= frmt("Progress:  %zu finished, %zu running, %zu remaining, ETA %s",
+				  count_finished, running.size(), count_pending,
+				  eta < 0 ? "unknown" : format_duration(eta).c_str());
+		for (size_t i= 0;  i < running.size() && i < count_top;  ++i)
+			text += frmt("%s %s (%s)", i == 0 ? ";  longest running" : ",",
+				     running[i].target.c_str(),
+				     format_duration(running[i].time_elapsed).c_str());
+		print_out(text);
+		fflush(stdout);
+	}
+
+	if (filename)
+		write(running, false);
+}
+
+void Progress::close()
+{
+	if (! filename)
+		return;
+	vector <Running> running;
+	write(running, true);
+}
+
+double Progress::get_eta(const vector <Running> &running)
+{
+	double remaining_max= 0, remaining_sum= 0;
+	bool known= duration_pending > 0;
+	for (const Running &r:  running) {
+		if (r.time_remaining > 0)
+			known= true;
+		remaining_max= max(remaining_max, r.time_remaining);
+		remaining_sum += r.time_remaining;
+	}
+	if (! known)
+		return -1;
+	return max(remaining_max, (remaining_sum + duration_pending) / jobs);
+}
+
+string Progress::format_duration(double duration)
+{
+	long seconds= (long) (duration + 0.5);
+	if (seconds >= 3600)
+		return frmt("%ld:%02ld:%02ld", seconds / 3600, seconds / 60 % 60, seconds % 60);
+	return frmt("%ld:%02ld", seconds / 60, seconds % 60);
+}
+
+void Progress::write(const vector <Running> &running, bool done)
+{
+	string content= frmt("state %s\nfinished %zu\nrunning %zu\nremaining %zu\n",
+			     done ? "done" : "running",
+			     count_finished, running.size(), count_pending);
+	double eta= done ? 0 : get_eta(running);
+	content += eta < 0 ? string("eta unknown\n") : frmt("eta %.3f\n", eta);
+	for (const Running &r:  running)
+		content += frmt("job %.3f %s\n", r.time_elapsed, r.target.c_str());
+
+	/* Write to a temporary file and rename it, such that a reader
+	 * never sees a partially written file */
+	string filename_tmp= string(filename) + ".tmp";
+	FILE *file= fopen(filename_tmp.c_str(), "w");
+	if (file == nullptr)
+		goto error;
+	if (fwrite(content.c_str(), 1, content.size(), file) != content.size()) {
+		fclose(file);
+		goto error_unlink;
+	}
+	if (fclose(file) != 0)
+		goto error_unlink;
+	if (rename(filename_tmp.c_str(), filename) != 0)
+		goto error_unlink;
+	return;
+
+ error_unlink:
+	{
+		int errno_save= errno;
+		unlink(filename_tmp.c_str());
+		errno= errno_save;
+	}
+ error:
+	if (warned)
+		return;
+	warned= true;
+	print_warning(Place(Place::Type::OPTION, 'S'),
+		      system_format(fmt("File %s cannot be written",
+					name_format_err(filename))));
+}
+
+#endif /* ! PROGRESS_HH */
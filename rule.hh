@@ -5,10 +5,14 @@
  * Data structures for representing rules. 
  */
 
+#include <algorithm>
 #include <unordered_map>
 
 #include "token.hh"
 #include "explain.hh"
+#include "trie.hh"
+#include "pool.hh"
+#include "counters.hh"
 
 class Rule
 /* A rule.  The class Rule allows parameters; there is no
@@ -57,6 +61,16 @@ public:
 	/* Whether the rule is a copy rule, i.e., declared with '='
 	 * followed by a filename. */ 
 
+	const Place place_restat;
+	/* Place of the -r flag; empty when the flag is not used.  With
+	 * the flag, a file target whose modification time is not
+	 * changed by the command is considered to not have been
+	 * rebuilt.  */ 
+
+	Pool *const pool;
+	/* The pool given by the -u flag; null when the flag is not
+	 * used.  */
+
 	Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets,
 	     vector <shared_ptr <const Dep> > &&deps_,
 	     const Place &place_,
@@ -64,7 +78,9 @@ public:
 	     Name &&filename_,
 	     bool is_hardcode_,
 	     int redirect_index_,
-	     bool is_copy_); 
+	     bool is_copy_,
+	     const Place &place_restat_,
+	     Pool *pool_); 
 	/* Direct constructor that specifies everything; no checks,
 	 * initialization or canonicalization is performed.  */
 
@@ -73,8 +89,12 @@ public:
 	     shared_ptr <const Command> command_,
 	     bool is_hardcode_,
 	     int redirect_index_,
-	     const Name &filename_input_);
-	/* Regular rule:  all cases except copy rules */
+	     const Name &filename_input_,
+	     const Place &place_restat_,
+	     Pool *pool_);
+	/* Regular rule:  all cases except copy rules.  PLACE_RESTAT is
+	 * empty when the -r flag is not used, and POOL is null when the
+	 * -u flag is not used.  */
 
 	Rule(shared_ptr <const Place_Param_Target> place_param_target_,
 	     shared_ptr <const Place_Name> place_name_source_,
@@ -129,6 +149,60 @@ private:
 	vector <shared_ptr <const Rule> > rules_parametrized;
 	/* All parametrized rules. */ 
 
+	vector <shared_ptr <Rule> > rules;
+	/* All rules, in the order in which they were added.  Used by
+	 * watch mode to build a new rule set when a source file has
+	 * changed.  */ 
+
+	vector <pair <shared_ptr <const Rule>,
+		      shared_ptr <const Place_Param_Target> > > targets_parametrized;
+	/* All targets of all parametrized rules, together with their
+	 * rule.  In the order of RULES_PARAMETRIZED, and then in the
+	 * order of the targets within each rule.  */ 
+
+	Trie index_prefix[2], index_suffix[2];
+	/* Indexes of TARGETS_PARAMETRIZED by the constant text before
+	 * the first parameter, and by the reversed constant text after
+	 * the last parameter.  [0] contains file targets and [1]
+	 * transient targets.  */
+
+	void get_candidates(const string &name, 
+			    bool transient,
+			    vector <size_t> &candidates) const;
+	/* Write into CANDIDATES the indexes within
+	 * TARGETS_PARAMETRIZED of those targets that may match NAME,
+	 * in ascending order.  Targets that are not returned are
+	 * guaranteed to not match.  CANDIDATES is empty on calling.  */
+
+	struct Cache_Entry
+	{
+		shared_ptr <const Rule> rule, param_rule;
+		map <string, string> mapping_parameter; 
+	};
+
+	unordered_map <Target, Cache_Entry> cache_parametrized;
+	/* The results of matching targets to parametrized rules, by
+	 * canonicalized target.  Targets for which no rule matches are
+	 * included with a null RULE.  Targets for which an error was
+	 * thrown are not included.  */
+
+	size_t count_cache_hit= 0, count_cache_miss= 0;
+	/* Number of lookups in CACHE_PARAMETRIZED */ 
+
+	shared_ptr <const Rule> get_parametrized(const Target &target, 
+						 shared_ptr <const Rule> &param_rule,
+						 map <string, string> &mapping_parameter,
+						 const Place &place) const;
+	/* Search the parametrized rules, with the same semantics as
+	 * get().  TARGET is canonicalized.  */
+
+	static string get_prefix(const Name &name);
+	static string get_suffix(const Name &name);
+	/* The keys of NAME in INDEX_PREFIX and INDEX_SUFFIX.  Every
+	 * string matched by NAME begins with the prefix and ends with
+	 * the suffix, taking into account special rules.  The suffix is
+	 * reversed.  */
+
 public:
 	void add(vector <shared_ptr <Rule> > &rules_);
 	/* Add rules to this rule set.  While adding rules, check for
@@ -148,11 +222,19 @@ public:
 	 * (possibly parametrized) rule into PARAM_RULE and the matched
 	 * parameters into MAPPING_PARAMETER.  Throws errors, in which
 	 * case PARAM_RULE is never set.  PLACE is the place of the
-	 * dependency; used in error messages.  */ 
+	 * dependency; used in error messages.  The result of matching
+	 * parametrized rules is cached, and therefore the same
+	 * instantiated rule is returned when called again for the same
+	 * target.  */ 
+
+	const vector <shared_ptr <Rule> > &get_rules() const {  return rules;  }
 
 	void print() const;
 	/* Print the rule set to standard output, as used by the -P and
 	 * -d options */   
+
+	void print_statistics() const;
+	/* Print statistics about rule lookups, as used by the -z option */ 
 };
 
 Rule::Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets_,
@@ -162,7 +244,9 @@ Rule::Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets
 	   Name &&filename_,
 	   bool is_hardcode_,
 	   int redirect_index_,
-	   bool is_copy_)
+	   bool is_copy_,
+	   const Place &place_restat_,
+	   Pool *pool_)
 	:  place_param_targets(place_param_targets_),
 	   deps(deps_),
 	   place(place_),
@@ -170,7 +254,9 @@ Rule::Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets
 	   filename(filename_),
 	   redirect_index(redirect_index_),
 	   is_hardcode(is_hardcode_),
-	   is_copy(is_copy_)
+	   is_copy(is_copy_),
+	   place_restat(place_restat_),
+	   pool(pool_)
 {  }
 
 Rule::Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets_,
@@ -178,7 +264,9 @@ Rule::Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets
 	   shared_ptr <const Command> command_,
 	   bool is_hardcode_,
 	   int redirect_index_,
-	   const Name &filename_)
+	   const Name &filename_,
+	   const Place &place_restat_,
+	   Pool *pool_)
 	:  place_param_targets(place_param_targets_), 
 	   deps(deps_),
   	   place(place_param_targets_[0]->place),
@@ -186,7 +274,9 @@ Rule::Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets
 	   filename(filename_),
 	   redirect_index(redirect_index_),
 	   is_hardcode(is_hardcode_),
-	   is_copy(false)
+	   is_copy(false),
+	   place_restat(place_restat_),
+	   pool(pool_)
 { 
 	assert(place_param_targets.size() != 0); 
 	assert(redirect_index>= -1);
@@ -218,7 +308,8 @@ Rule::Rule(shared_ptr <const Place_Param_Target> place_param_target_,
 	   filename(*place_name_source_),
 	   redirect_index(-1),
 	   is_hardcode(false),
-	   is_copy(true)
+	   is_copy(true),
+	   pool(nullptr)
 {
 	auto dep= make_shared <Plain_Dep> 
 		(Place_Param_Target(0, *place_name_source_));
@@ -261,7 +352,9 @@ Rule::instantiate(shared_ptr <const Rule> rule,
 		 move(rule->filename.instantiate(mapping)),
 		 rule->is_hardcode,
 		 rule->redirect_index,
-		 rule->is_copy); 
+		 rule->is_copy,
+		 rule->place_restat,
+		 rule->pool); 
 }
 
 string Rule::format_out() const
@@ -269,6 +362,11 @@ string Rule::format_out() const
 	string ret;
 
 	ret += "Rule(";
+
+	if (! place_restat.empty())
+		ret += "-r ";
+	if (pool)
+		ret += "-u " + pool->name + " ";
 	
 	bool first= true;
 	for (auto place_param_target:  place_param_targets) {
@@ -387,7 +485,18 @@ void Rule_Set::add(vector <shared_ptr <Rule> > &rules_)
 		} else {
 			rule->canonicalize(); 
 			rules_parametrized.push_back(rule); 
+			for (auto &place_param_target:  rule->place_param_targets) {
+				size_t k= targets_parametrized.size(); 
+				targets_parametrized.push_back
+					(make_pair(rule, place_param_target)); 
+				int i= (place_param_target->flags & F_TARGET_TRANSIENT) != 0; 
+				const Name &name= place_param_target->place_name; 
+				index_prefix[i].insert(get_prefix(name), k);
+				index_suffix[i].insert(get_suffix(name), k); 
+			}
 		}
+
+		rules.push_back(rule); 
 	}
 }
 
@@ -400,6 +509,9 @@ shared_ptr <const Rule> Rule_Set::get(Target target,
 	assert((target.get_front_word() & ~F_TARGET_TRANSIENT) == 0); 
 	assert(mapping_parameter.size() == 0); 
 
+	Counters::add(Counters::C_RULE_GET); 
+	Counters::Timing timing(Counters::T_RULE_GET); 
+
 	target.canonicalize(); 
 
 	/* Check for an unparametrized rule.  Since we keep them in a
@@ -429,10 +541,47 @@ shared_ptr <const Rule> Rule_Set::get(Target target,
 		return rule;
 	}
 
-	/* Search the best parametrized rule.  Since this implementation
-	 * does not have an index for parametrized rules, we simply
-	 * check all rules, and choose the best-fitting one.  This can
-	 * be optimized, but the optimization is not trivial.  */ 
+	/* Check whether the target was already matched */
+	auto j= cache_parametrized.find(target); 
+	if (j != cache_parametrized.end()) {
+		++count_cache_hit;
+		if (j->second.rule != nullptr) {
+			param_rule= j->second.param_rule;
+			mapping_parameter= j->second.mapping_parameter; 
+		}
+		return j->second.rule; 
+	}
+	++count_cache_miss;
+
+	Cache_Entry &entry= cache_parametrized[target]; 
+	try {
+		entry.rule= get_parametrized(target, entry.param_rule,
+					     entry.mapping_parameter, place);
+	} catch (int) {
+		/* Errors are not cached, such that they are reported
+		 * each time */ 
+		cache_parametrized.erase(target); 
+		throw; 
+	}
+	if (entry.rule != nullptr) {
+		param_rule= entry.param_rule;
+		mapping_parameter= entry.mapping_parameter; 
+	}
+	return entry.rule; 
+}
+
+shared_ptr <const Rule> Rule_Set::get_parametrized(const Target &target, 
+						   shared_ptr <const Rule> &param_rule,
+						   map <string, string> &mapping_parameter,
+						   const Place &place) const
+{
+	/* Search the best parametrized rule.  Only the rules found in
+	 * the index are checked, in the order in which they were
+	 * declared, and the best-fitting one is chosen.  */ 
+
+	vector <size_t> candidates;
+	get_candidates(target.get_name_nondynamic(), target.is_transient(), candidates); 
+	Counters::add(Counters::C_RULE_CANDIDATES, candidates.size()); 
 
 	/* Element [0] corresponds to the best rule. */ 
 	vector <shared_ptr <const Rule> > rules_best;
@@ -441,68 +590,68 @@ shared_ptr <const Rule> Rule_Set::get(Target target,
 	vector <int> priorities_best;
 	vector <shared_ptr <const Place_Param_Target> > place_param_targets_best; 
 
-	for (auto &rule:  rules_parametrized) {
-
-		for (auto &place_param_target:  rule->place_param_targets) {
+	for (size_t candidate:  candidates) {
+		const shared_ptr <const Rule> &rule= 
+			targets_parametrized[candidate].first; 
+		const shared_ptr <const Place_Param_Target> &place_param_target=
+			targets_parametrized[candidate].second; 
 
-			assert(place_param_target->place_name.get_n() > 0);
-		
-			map <string, string> mapping;
-			vector <size_t> anchoring;
-			int priority;
-
-			/* The parametrized rule is of another type */ 
-			if (target.get_front_word() !=
-			    (place_param_target->flags & F_TARGET_TRANSIENT))
-				continue;
-
-			/* The parametrized rule does not match */ 
-			if (! place_param_target->place_name.match(target.get_name_nondynamic(),
-								   mapping, anchoring, priority))
-				continue; 
-
-			assert(anchoring.size() == 
-			       (2 * place_param_target->place_name.get_n())); 
-
-			size_t k= rules_best.size(); 
-			assert(k == anchorings_best.size()); 
-			assert(k == priorities_best.size());
-			assert(k == mappings_best.size());
-
-			/* Check whether the rule is dominated by at least one other rule */
-			for (size_t j= 0;  j < k;  ++j) {
-				if (Name::anchoring_dominates
-				    (anchorings_best[j], anchoring,
-				     priorities_best[j], priority)) {
-					goto dont_add;
-				}
+		assert(place_param_target->place_name.get_n() > 0);
+	
+		/* The index contains only rules of the same type */ 
+		assert(target.get_front_word() ==
+		       (place_param_target->flags & F_TARGET_TRANSIENT));
+
+		map <string, string> mapping;
+		vector <size_t> anchoring;
+		int priority;
+
+		/* The parametrized rule does not match */ 
+		if (! place_param_target->place_name.match(target.get_name_nondynamic(),
+							   mapping, anchoring, priority))
+			continue; 
+
+		assert(anchoring.size() == 
+		       (2 * place_param_target->place_name.get_n())); 
+
+		size_t k= rules_best.size(); 
+		assert(k == anchorings_best.size()); 
+		assert(k == priorities_best.size());
+		assert(k == mappings_best.size());
+
+		/* Check whether the rule is dominated by at least one other rule */
+		for (size_t j= 0;  j < k;  ++j) {
+			if (Name::anchoring_dominates
+			    (anchorings_best[j], anchoring,
+			     priorities_best[j], priority)) {
+				goto dont_add;
 			}
-
-			/* Check whether the rule dominates all other rules */ 
-			{
-				bool is_best= true;
-				for (ssize_t j= 0;  is_best && j < (ssize_t) k;  ++j) {
-					if (! Name::anchoring_dominates
-					    (anchoring, anchorings_best[j],
-					     priority, priorities_best[j]))
-						is_best= false;
-				}
-				if (is_best) {
-					k= 0;
-				}
-			} 
-			rules_best.resize(k+1); 
-			mappings_best.resize(k+1);
-			anchorings_best.resize(k+1);
-			priorities_best.resize(k+1); 
-			place_param_targets_best.resize(k+1); 
-			rules_best[k]= rule;
-			swap(mapping, mappings_best[k]);
-			swap(anchoring, anchorings_best[k]);
-			priorities_best[k]= priority; 
-			place_param_targets_best[k]= place_param_target;
-		dont_add:;
 		}
+
+		/* Check whether the rule dominates all other rules */ 
+		{
+			bool is_best= true;
+			for (ssize_t j= 0;  is_best && j < (ssize_t) k;  ++j) {
+				if (! Name::anchoring_dominates
+				    (anchoring, anchorings_best[j],
+				     priority, priorities_best[j]))
+					is_best= false;
+			}
+			if (is_best) {
+				k= 0;
+			}
+		} 
+		rules_best.resize(k+1); 
+		mappings_best.resize(k+1);
+		anchorings_best.resize(k+1);
+		priorities_best.resize(k+1); 
+		place_param_targets_best.resize(k+1); 
+		rules_best[k]= rule;
+		swap(mapping, mappings_best[k]);
+		swap(anchoring, anchorings_best[k]);
+		priorities_best[k]= priority; 
+		place_param_targets_best[k]= place_param_target;
+	dont_add:;
 	}
 
 	/* No rule matches */ 
@@ -533,6 +682,75 @@ shared_ptr <const Rule> Rule_Set::get(Target target,
 	return ret;
 }
 
+void Rule_Set::get_candidates(const string &name, 
+			      bool transient,
+			      vector <size_t> &candidates) const
+{
+	assert(candidates.empty()); 
+
+	vector <size_t> candidates_prefix, candidates_suffix; 
+	index_prefix[transient].find(name, candidates_prefix); 
+	index_suffix[transient].find(string(name.rbegin(), name.rend()),
+				     candidates_suffix); 
+
+	/* Go through the smaller of the two lists, and check the other
+	 * condition directly */ 
+	if (candidates_prefix.size() <= candidates_suffix.size()) {
+		for (size_t k:  candidates_prefix) {
+			string suffix= get_suffix
+				(targets_parametrized[k].second->place_name); 
+			if (suffix.size() <= name.size() &&
+			    equal(suffix.begin(), suffix.end(), name.rbegin())) 
+				candidates.push_back(k); 
+		}
+	} else {
+		for (size_t k:  candidates_suffix) {
+			string prefix= get_prefix
+				(targets_parametrized[k].second->place_name); 
+			if (name.compare(0, prefix.size(), prefix) == 0)
+				candidates.push_back(k); 
+		}
+	}
+
+	/* Restore the order of declaration, which determines the order
+	 * of rules in error messages */ 
+	sort(candidates.begin(), candidates.end()); 
+}
+
+string Rule_Set::get_prefix(const Name &name)
+{
+	assert(name.get_n() != 0); 
+	const string &text= name.get_texts()[0]; 
+
+	/* Special rule (a):  './$A' matches names without './' */
+	if (text == "./")
+		return "";
+
+	return text; 
+}
+
+string Rule_Set::get_suffix(const Name &name)
+{
+	const size_t n= name.get_n(); 
+	assert(n != 0); 
+	const vector <string> &texts= name.get_texts(); 
+
+	/* Special rule (c):  '$A/bbb' matches 'bbb' with $A set to '.',
+	 * which is checked without anchoring the end of the name */ 
+	if (n == 1 && texts[0] == "" && texts[1].size() != 0 && texts[1][0] == '/')
+		return "";
+
+	return string(texts[n].rbegin(), texts[n].rend()); 
+}
+
+void Rule_Set::print_statistics() const
+{
+	printf("STATISTICS  parametrized rule lookups = %zu "
+	       "(%zu cached, %zu not cached)\n", 
+	       count_cache_hit + count_cache_miss,
+	       count_cache_hit, count_cache_miss); 
+}
+
 void Rule_Set::print() const
 {
 	for (auto i:  rules_unparametrized)  {
@@ -0,0 +1,98 @@
+#ifndef STATE_HH
+#define STATE_HH
+
+/*
+ * Files in which Stu keeps state between invocations, when requested
+ * by an option.  Such a file consists of fields that are each
+ * terminated by '\0', the first of which identifies the format.  The
+ * state is only an optimization:  when a state file cannot be read or
+ * is malformed, it is ignored, and when it cannot be written, a
+ * warning is output.
+ */
+
+#include <unistd.h>
+
+bool read_state(const char *filename, const char *header,
+		vector <string> &fields);
+/* Read the fields of the given file into FIELDS, without the header.
+ * Return whether the file could be read and has the given header.  */
+
+void write_state(const char *filename, const char *header,
+		 const vector <string> &fields, char option);
+/* Write the given fields with the header, replacing the file
+ * atomically.  OPTION is the option by which the file was given, and
+ * is used in the warning.  */
+
+string format_file_state(struct stat *buf);
+/* The modification time and size of an existing file, as used in state
+ * files to detect whether a file has changed */
+
+bool read_state(const char *filename, const char *header,
+		vector <string> &fields)
+{
+	FILE *file= fopen(filename, "r");
+	if (file == nullptr)
+		return false;
+
+	string content;
+	char buf[0x1000];
+	size_t len;
+	while ((len= fread(buf, 1, sizeof(buf), file)) != 0)
+		content.append(buf, len);
+	bool error_read= ferror(file);
+	if (fclose(file) != 0 || error_read)
+		return false;
+
+	size_t begin= 0;
+	for (size_t end;  (end= content.find('\0', begin)) != string::npos;  begin= end + 1)
+		fields.push_back(content.substr(begin, end - begin));
+	if (begin != content.size() || fields.empty() || fields[0] != header) {
+		fields.clear();
+		return false;
+	}
+	fields.erase(fields.begin());
+	return true;
+}
+
+void write_state(const char *filename, const char *header,
+		 const vector <string> &fields, char option)
+{
+	string content= string(header) + '\0';
+	for (const string &field:  fields)
+		content += field + '\0';
+
+	/* Write to a temporary file and rename it, such that an
+	 * interrupted Stu never leaves a truncated file */
+	string filename_tmp= string(filename) + ".tmp";
+	FILE *file= fopen(filename_tmp.c_str(), "w");
+	if (file == nullptr)
+		goto error;
+	if (fwrite(content.c_str(), 1, content.size(), file) != content.size()) {
+		fclose(file);
+		goto error_unlink;
+	}
+	if (fclose(file) != 0)
+		goto error_unlink;
+	if (rename(filename_tmp.c_str(), filename) != 0)
+		goto error_unlink;
+	return;
+
+ error_unlink:
+	{
+		int errno_save= errno;
+		unlink(filename_tmp.c_str());
+		errno= errno_save;
+	}
+ error:
+	print_warning(Place(Place::Type::OPTION, option),
+		      system_format(fmt("File %s cannot be written",
+					name_format_err(filename))));
+}
+
+string format_file_state(struct stat *buf)
+{
+	return frmt("%s %jd", Timestamp(buf).format().c_str(),
+		    (intmax_t) buf->st_size);
+}
+
+#endif /* ! STATE_HH */
@@ -25,6 +25,7 @@ using namespace std;
 #include "rule.hh"
 #include "timestamp.hh"
 #include "color.hh"
+#include "watch.hh"
 
 /*
  * Note:  Stu does not call setlocale(), and therefore can make use of
@@ -41,7 +42,7 @@ using namespace std;
  * the platform:  GNU getopt() will all options to follow arguments,
  * while BSD getopt() does not. 
  */
-const char OPTIONS[]= "0:ac:C:dEf:F:ghij:JkKm:M:n:o:p:PqsVxyYz"; 
+const char OPTIONS[]= "0:aA:B:c:C:dEf:F:gGhH:ij:JkKL:m:M:n:N:o:p:PqR:sS:T:VwxyYzZ:"; 
 
 /* The output of the help (-h) option.  The following strings do not
  * contain tabs, but only space characters.  */   
@@ -52,6 +53,11 @@ const char HELP[]=
 	"Options:\n"						       
 	"  -0 FILENAME      Read \\0-separated file targets from the given file\n"
 	"  -a               Treat all trivial dependencies as non-trivial\n"          
+	"  -A FILENAME      Write the resources used by each job to the given file as\n"
+	"                   tab-separated values\n"
+	"  -B SIZE          Start jobs only when their memory use as recorded by the\n"
+	"                   option -T fits into SIZE (e.g. '8G'), or into the\n"
+	"                   available memory with 'avail'\n"
 	"  -c FILENAME      Pass a target filename without Stu syntax parsing\n"      
 	"  -C EXPRESSIONS   Pass a target in full Stu syntax\n"		              
 	"  -d               Debug mode: show execution information on stderr\n"     
@@ -59,28 +65,43 @@ const char HELP[]=
 	"  -f FILENAME      The input file to use instead of 'main.stu'\n"            
 	"  -F RULES         Pass rules in Stu syntax\n"                               
 	"  -g               Treat all optional dependencies as non-optional\n"        
+	"  -G               Output the progress and an estimated time of arrival\n"
+	"                   whenever a job has finished\n"
 	"  -h               Output help and exit\n"		                      
+	"  -H FILENAME      Rebuild only when the content of files has changed, using\n"
+	"                   the given file to store digests\n"
 	"  -i               Interactive mode (run jobs in foreground)\n"
 	"  -j K             Run K jobs in parallel\n"			              
 	"  -J               Disable Stu syntax in arguments\n"                        
 	"  -k               Keep on running after errors\n"		              
 	"  -K               Don't delete target files on error or interruption\n"     
+	"  -L K             Adapt the number of parallel jobs between K and the value\n"
+	"                   of -j to the pressure on the system\n"
 	"  -m ORDER         Order to run the targets:\n"			      
 	"     dfs           (default) Depth-first order, like in Make\n"	      
 	"     random        Random order\n"				              
+	"     critical      Longest critical path first, as recorded with -T\n"
 	"  -M STRING        Pseudorandom run order, seeded by given string\n"         
 	"  -n FILENAME      Read \\n-separated file targets from the given file\n"
+	"  -N FILENAME      Use the given manifest file to skip null builds\n"
 	"  -o FILENAME      Build an optional dependency, i.e., build it only if it\n"
 	"                   exists and is out of date\n"
 	"  -p FILENAME      Build a persistent dependency, i.e., ignore its timestamp\n"
 	"  -P               Print the rules and exit\n"                               
 	"  -q               Question mode: check whether targets are up to date\n"    
+	"  -R FILENAME      Write a timeline of the jobs in the trace event format of\n"
+	"                   Chrome to the given file\n"
 	"  -s               Silent mode: don't use stdout\n"
+	"  -S FILENAME      Keep the progress of the build in the given status file\n"
+	"  -T FILENAME      Record the durations of jobs in the given file\n"
 	"  -V               Output version and exit\n"				      
+	"  -w               Watch mode: rebuild whenever a file is changed\n"
 	"  -x               Output each line in a command individually\n"              
 	"  -y               Disable color in output\n"                                
 	"  -Y               Enable color in output\n"
 	"  -z               Output run-time statistics on stdout\n"                   
+	"  -Z FILENAME      Write internal counters and timers of Stu as JSON to the\n"
+	"                   given file\n"
 	"Report bugs to: " PACKAGE_BUGREPORT "\n" 
 	"Stu home page: <" PACKAGE_URL ">\n";
 
@@ -107,6 +128,7 @@ bool stu_setting(char c)
 	default:  return false;
 
 	case 'E':  option_explain= true;        break;
+	case 'G':  option_progress= true;       break;
 	case 's':  option_silent= true;         break;
 	case 'x':  option_individual= true;     break;
 	case 'y':  Color::set(false);           break;
@@ -123,6 +145,7 @@ int main(int argc, char **argv, char **envp)
 	dollar_zero= argv[0]; 
 	envp_global= (const char **) envp; 
 	init_buf();
+	Manifest::args.assign(argv + 1, argv + argc);
 	Job::init_tty();
 	Color::set();
 	int error= 0;
@@ -191,6 +214,7 @@ int main(int argc, char **argv, char **envp)
 			case 'K': option_no_delete= true;      break;
 			case 'P': option_print= true;          break;  
 			case 'q': option_question= true;       break;
+			case 'w': option_watch= true;          break;
 
 			case 'c':  {
 				had_option_target= true; 
@@ -225,14 +249,29 @@ int main(int argc, char **argv, char **envp)
 				}
 				had_option_f= true;
 				filenames.push_back(optarg); 
-				Parser::get_file(optarg, -1, Execution::rule_set,
-						 target_first, place_first);
+				{
+					Timeline::Span span("parse"); 
+					Parser::get_file(optarg, -1, Execution::rule_set,
+							 target_first, place_first);
+				}
 			end:
 				break;
 
+			case 'H':
+				if (*optarg == '\0') {
+					Place(Place::Type::OPTION, 'H') <<
+						"expected a non-empty argument"; 
+					exit(ERROR_FATAL);
+				}
+				Digest::filename= optarg;
+				break;
+
 			case 'F':
 				had_option_f= true;
-				Parser::get_string(optarg, Execution::rule_set, target_first);
+				{
+					Timeline::Span span("parse"); 
+					Parser::get_string(optarg, Execution::rule_set, target_first);
+				}
 				break;
 
 			case 'i':
@@ -262,6 +301,24 @@ int main(int argc, char **argv, char **envp)
 				break;
 			}
 
+			case 'L':  {
+				errno= 0;
+				char *endptr;
+				Adapt::jobs_min= strtol(optarg, &endptr, 10);
+				Place place(Place::Type::OPTION, c); 
+				if (errno != 0 || *endptr != '\0') {
+					place << fmt("expected the number of jobs, not %s",
+						     name_format_err(optarg)); 
+					exit(ERROR_FATAL); 
+				}
+				if (Adapt::jobs_min < 1) {
+					place << fmt("expected a positive number of jobs, not %s",
+						     name_format_err(optarg));
+					exit(ERROR_FATAL); 
+				}
+				break;
+			}
+
 			case 'm':
 				if (!strcmp(optarg, "random"))  {
 					order= Order::RANDOM;
@@ -275,12 +332,15 @@ int main(int argc, char **argv, char **envp)
 					}
 					buffer_generator.seed(tv.tv_sec + tv.tv_usec); 
 				}
+				else if (!strcmp(optarg, "critical"))
+					order= Order::CRITICAL; 
 				else if (!strcmp(optarg, "dfs"))     /* Default */ ;
 				else {
-					print_error(fmt("Invalid argument %s for option %s-m%s; valid values are %s and %s", 
+					print_error(fmt("Invalid argument %s for option %s-m%s; valid values are %s, %s and %s", 
 							name_format_err(optarg),
 							Color::word, Color::end,
 							name_format_err("random"),
+							name_format_err("critical"),
 							name_format_err("dfs"))); 
 					exit(ERROR_FATAL); 
 				}
@@ -309,6 +369,69 @@ int main(int argc, char **argv, char **envp)
 				break;
 			}
 
+			case 'N':
+				if (*optarg == '\0') {
+					Place(Place::Type::OPTION, 'N') <<
+						"expected a non-empty argument"; 
+					exit(ERROR_FATAL);
+				}
+				Manifest::filename= optarg;
+				break;
+
+			case 'A':
+				if (*optarg == '\0') {
+					Place(Place::Type::OPTION, 'A') <<
+						"expected a non-empty argument"; 
+					exit(ERROR_FATAL);
+				}
+				Accounting::filename= optarg;
+				break;
+
+			case 'B':  {
+				string message= Memory::parse(optarg);
+				if (! message.empty()) {
+					Place(Place::Type::OPTION, c) << message;
+					exit(ERROR_FATAL);
+				}
+				break;
+			}
+
+			case 'S':
+				if (*optarg == '\0') {
+					Place(Place::Type::OPTION, 'S') <<
+						"expected a non-empty argument"; 
+					exit(ERROR_FATAL);
+				}
+				Progress::filename= optarg;
+				break;
+
+			case 'Z':
+				if (*optarg == '\0') {
+					Place(Place::Type::OPTION, 'Z') <<
+						"expected a non-empty argument"; 
+					exit(ERROR_FATAL);
+				}
+				Counters::filename= optarg;
+				break;
+
+			case 'R':
+				if (*optarg == '\0') {
+					Place(Place::Type::OPTION, 'R') <<
+						"expected a non-empty argument"; 
+					exit(ERROR_FATAL);
+				}
+				Timeline::filename= optarg;
+				break;
+
+			case 'T':
+				if (*optarg == '\0') {
+					Place(Place::Type::OPTION, 'T') <<
+						"expected a non-empty argument"; 
+					exit(ERROR_FATAL);
+				}
+				History::filename= optarg;
+				break;
+
 			case 'o':
 			case 'p':  {
 				had_option_target= true; 
@@ -344,6 +467,36 @@ int main(int argc, char **argv, char **envp)
 
 		order_vec= (order == Order::RANDOM);
 
+		/* In watch mode, builds are never aborted, such that the
+		 * execution graph can be used again by the next build */
+		if (option_watch)
+			option_keep_going= true;
+
+		if (order == Order::CRITICAL && ! History::filename) {
+			Place(Place::Type::OPTION, 'm')
+				<< fmt("order %s requires the option %s",
+				       name_format_err("critical"),
+				       multichar_format_err("-T")); 
+			exit(ERROR_FATAL); 
+		}
+
+		if (Memory::budget && ! History::filename) {
+			Place(Place::Type::OPTION, 'B')
+				<< fmt("option %s requires the option %s",
+				       multichar_format_err("-B"),
+				       multichar_format_err("-T")); 
+			exit(ERROR_FATAL); 
+		}
+
+		if (Adapt::jobs_min > Execution::jobs) {
+			Place(Place::Type::OPTION, 'L')
+				<< fmt("minimal number of jobs %s must not be larger than the number of jobs %s given by %s",
+				       name_format_err(frmt("%ld", Adapt::jobs_min)),
+				       name_format_err(frmt("%ld", Execution::jobs)),
+				       multichar_format_err("-j")); 
+			exit(ERROR_FATAL); 
+		}
+
 		if (option_interactive && option_parallel) {
 			Place(Place::Type::OPTION, 'i')
 				<< fmt("parallel mode using %s cannot be used in interactive mode",
@@ -379,8 +532,10 @@ int main(int argc, char **argv, char **envp)
 		/* Use the default Stu script if -f/-F are not used */ 
 		if (! had_option_f) {
 			filenames.push_back(FILENAME_INPUT_DEFAULT); 
+			Counters::add(Counters::C_OPEN); 
 			int file_fd= open(FILENAME_INPUT_DEFAULT, O_RDONLY); 
 			if (file_fd >= 0) {
+				Timeline::Span span("parse"); 
 				Parser::get_file("", file_fd, 
 						 Execution::rule_set, target_first,
 						 place_first); 
@@ -411,7 +566,8 @@ int main(int argc, char **argv, char **envp)
 
 		/* If no targets are given on the command line,
 		 * use the first non-variable target */ 
-		if (deps.empty() && ! had_option_target) {
+		const bool target_default= deps.empty() && ! had_option_target; 
+		if (target_default) {
 
 			if (target_first == nullptr) {
 				if (! place_first.empty()) {
@@ -433,21 +589,57 @@ int main(int argc, char **argv, char **envp)
 			deps.push_back(make_shared <Plain_Dep> (*target_first));  
 		}
 
-		/* Execute */
-		Execution::main(deps);
+		Timeline::open();
+
+		/* Execute, unless the manifest shows that the targets are
+		 * up to date */
+		if (Manifest::filename && ! option_debug && ! option_watch 
+		    && Manifest::check()) {
+			print_out("Targets are up to date");
+		} else {
+			if (Digest::filename)
+				Digest::read();
+			if (History::filename)
+				History::read();
+			if (option_watch)
+				Watch::loop(deps, target_default, filenames); 
+			Execution::main(deps);
+		}
 
 	} catch (int e) {
 		assert(e >= 1 && e <= 3); 
 		error= e;
 	}
 
+	/* In watch mode, an error before the first build means that the
+	 * source code must be changed */
+	if (option_watch)
+		Watch::wait_source(argv);
+
 	/*
 	 * Code executed before exiting:  This must be executed even if
 	 * Stu fails (but not for fatal errors).
 	 */
 	
+	if (Digest::filename)
+		Digest::write();
+	if (History::filename)
+		History::write();
+	Timeline::close();
+	Accounting::write();
+	Counters::write();
+	Progress::close();
+
 	if (option_statistics) {
 		Job::print_statistics();
+		Execution::rule_set.print_statistics();
+		Probe::print_statistics();
+		Pool::print_statistics();
+		Adapt::print_statistics();
+		Memory::print_statistics();
+		Accounting::print_statistics();
+		Critical::print_statistics();
+		Counters::print_statistics();
 	}
 
 	if (fclose(stdout)) {
@@ -3,6 +3,7 @@
 
 #include "flags.hh"
 #include "canonicalize.hh"
+#include "counters.hh"
 
 /* 
  * Targets are the individual "objects" of Stu.  They can be thought of
@@ -865,6 +866,7 @@ bool Name::match(const string name,
  * etc.) 
  */
 {
+	Counters::add(Counters::C_NAME_MATCH); 
 	assert(mapping.size() == 0); 
 	priority= 0;
 	map <string, string> ret;
@@ -0,0 +1,243 @@
+#ifndef TIMELINE_HH
+#define TIMELINE_HH
+
+/*
+ * Timeline of a build in the trace event format of Chrome, used with
+ * the -R option.  The resulting file can be loaded into a timeline
+ * viewer such as Perfetto (ui.perfetto.dev) or chrome://tracing.
+ *
+ * Each job is a complete event.  Jobs are placed on lanes ("job slot
+ * N"), such that the number of lanes is the largest number of jobs run
+ * at the same time, and gaps in the lanes show idle slots.  The lane
+ * "stu" shows spans of Stu itself:  parsing, rule lookup, reading of
+ * dynamic dependencies, and the concurrent stat() sweeps of probe.hh.
+ * Spans of Stu shorter than DURATION_MIN are omitted, such that the
+ * file stays manageable for large builds.  Times are given in
+ * microseconds since the start of Stu.
+ *
+ * The events are written while the build runs.  The closing bracket is
+ * written at the end; when Stu is killed, it is missing, which the
+ * viewers accept.
+ *
+ * Since the -R option may be given after the -f option, spans that
+ * occur before the options are fully parsed are kept in memory, and
+ * written once the file is opened.
+ */
+
+class Timeline
+{
+public:
+	static const char *filename;
+	/* Set by the -R option; null when not used */
+
+	class Span
+	/* A span of Stu during the lifetime of an object of this type */
+	{
+	public:
+		Span(const char *name_)
+			:  name(name_),
+			   time_begin(state == DISABLED ? 0 : Job::get_time())
+		{  }
+
+		~Span() {
+			if (state != DISABLED)
+				span(name, time_begin);
+		}
+
+	private:
+		const char *const name;
+		const double time_begin;
+	};
+
+	static void open();
+	/* Called once the options are parsed:  Open the file when the
+	 * option -R is used, and write what was kept meanwhile.  Exit on
+	 * errors.  */
+
+	static void close();
+	/* Finish the file, if it was opened */
+
+	static void flush();
+	/* Write out the events so far, if the file was opened.  Used in
+	 * watch mode, where the file is never finished.  */
+
+	static bool enabled() {  return state == ENABLED;  }
+
+	static size_t acquire_lane();
+	/* Take the lowest free lane for a job that is started */
+
+	static void job(size_t lane, const string &name, const Place &place,
+			pid_t pid, int status, double time_begin, double duration);
+	/* Write the event of a job that has finished, and free its lane.
+	 * STATUS is as returned by waitpid().  */
+
+private:
+	enum { STARTUP, ENABLED, DISABLED };
+
+	static int state;
+
+	static FILE *file;
+
+	static double time_origin;
+
+	static vector <string> kept;
+	/* Events from before the file was opened */
+
+	static bool first;
+	/* Whether no event was written yet */
+
+	static vector <bool> lanes;
+	/* Whether each lane is used */
+
+	static const double duration_min;
+
+	static void span(const char *name, double time_begin);
+
+	static void write(const string &event);
+
+	static string format_string(const string &text);
+	/* As a quoted JSON string */
+};
+
+const char *Timeline::filename= nullptr;
+int Timeline::state= Timeline::STARTUP;
+FILE *Timeline::file= nullptr;
+double Timeline::time_origin= Job::get_time();
+vector <string> Timeline::kept;
+bool Timeline::first= true;
+vector <bool> Timeline::lanes;
+const double Timeline::duration_min= 1e-4;
+
+void Timeline::open()
+{
+	if (! filename) {
+		state= DISABLED;
+		kept.clear();
+		return;
+	}
+
+	file= fopen(filename, "w");
+	if (file == nullptr) {
+		print_error_system(filename);
+		exit(ERROR_FATAL);
+	}
+	state= ENABLED;
+
+	fputs("[\n", file);
+	vector <string> events;
+	swap(events, kept);
+	write(frmt("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %ld, \"tid\": 0, "
+		   "\"args\": {\"name\": \"stu\"}}",
+		   (long) getpid()));
+	for (const string &event:  events)
+		write(event);
+}
+
+void Timeline::close()
+{
+	if (state != ENABLED)
+		return;
+	fputs("\n]\n", file);
+	if (fclose(file) != 0) {
+		print_error_system(filename);
+		exit(ERROR_FATAL);
+	}
+	file= nullptr;
+	state= DISABLED;
+}
+
+void Timeline::flush()
+{
+	if (state != ENABLED)
+		return;
+	if (fflush(file) != 0) {
+		print_error_system(filename);
+		exit(ERROR_FATAL);
+	}
+}
+
+size_t Timeline::acquire_lane()
+{
+	assert(state == ENABLED);
+	for (size_t i= 0;  i < lanes.size();  ++i) {
+		if (! lanes[i]) {
+			lanes[i]= true;
+			return i;
+		}
+	}
+	lanes.push_back(true);
+	size_t lane= lanes.size() - 1;
+	write(frmt("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %ld, \"tid\": %zu, "
+		   "\"args\": {\"name\": \"job slot %zu\"}}",
+		   (long) getpid(), lane + 1, lane + 1));
+	return lane;
+}
+
+void Timeline::job(size_t lane, const string &name, const Place &place,
+		pid_t pid, int status, double time_begin, double duration)
+{
+	assert(state == ENABLED);
+	assert(lane < lanes.size() && lanes[lane]);
+	lanes[lane]= false;
+
+	string args= frmt("\"pid\": %ld", (long) pid);
+	if (! place.empty())
+		args += ", \"place\": " + format_string(place.as_argv0());
+	if (WIFEXITED(status))
+		args += frmt(", \"exit status\": %d", WEXITSTATUS(status));
+	else if (WIFSIGNALED(status))
+		args += frmt(", \"signal\": %d", WTERMSIG(status));
+
+	write(frmt("{\"name\": %s, \"cat\": \"job\", \"ph\": \"X\", "
+		   "\"ts\": %.0f, \"dur\": %.0f, \"pid\": %ld, \"tid\": %zu, "
+		   "\"args\": {%s}}",
+		   format_string(name).c_str(),
+		   (time_begin - time_origin) * 1e6,
+		   duration * 1e6,
+		   (long) getpid(), lane + 1, args.c_str()));
+}
+
+void Timeline::span(const char *name, double time_begin)
+{
+	double time_end= Job::get_time();
+	if (time_end - time_begin < duration_min)
+		return;
+	write(frmt("{\"name\": \"%s\", \"cat\": \"stu\", \"ph\": \"X\", "
+		   "\"ts\": %.0f, \"dur\": %.0f, \"pid\": %ld, \"tid\": 0}",
+		   name,
+		   (time_begin - time_origin) * 1e6,
+		   (time_end - time_begin) * 1e6,
+		   (long) getpid()));
+}
+
+void Timeline::write(const string &event)
+{
+	if (state == STARTUP) {
+		kept.push_back(event);
+		return;
+	}
+	assert(state == ENABLED);
+	if (! first)
+		fputs(",\n", file);
+	fputs(event.c_str(), file);
+	first= false;
+}
+
+string Timeline::format_string(const string &text)
+{
+	string ret= "\"";
+	for (const char c:  text) {
+		if (c == '"' || c == '\\') {
+			ret += '\\';
+			ret += c;
+		} else if ((unsigned char) c < 0x20) {
+			ret += frmt("\\u%04x", (unsigned) (unsigned char) c);
+		} else {
+			ret += c;
+		}
+	}
+	ret += '"';
+	return ret;
+}
+
+#endif /* ! TIMELINE_HH */
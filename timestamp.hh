@@ -7,6 +7,9 @@
  *   - mtim:     nanosecond precision (in principle).  Works only on Linux; see below. 
  */
 
+#include <sys/stat.h>
+#include <time.h>
+
 #ifndef USE_MTIM
 #   if HAVE_CLOCK_REALTIME_COARSE
 #      define USE_MTIM 1
@@ -161,4 +164,18 @@ Timestamp Timestamp::startup= Timestamp::now();
 
 #endif /* variant */
 
+double get_time_monotonic()
+/* The time in seconds of the monotonic clock, used for measuring
+ * durations.  Unlike timestamps, it is not related to the time of
+ * files.  */
+{
+	struct timespec t;
+	if (clock_gettime(CLOCK_MONOTONIC, &t) != 0) {
+		/* Does not happen on supported systems */ 
+		assert(false); 
+		return 0; 
+	}
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
 #endif /* ! TIMESTAMP_HH */
@@ -10,9 +10,12 @@
 
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <stdint.h>
 
 #include "token.hh"
 #include "version.hh"
+#include "pool.hh"
+#include "counters.hh"
 
 const char *const FILENAME_INPUT_DEFAULT= "main.stu"; 
 /* The default filename read  */
@@ -70,6 +73,47 @@ public:
 	/* Parse tokens from the given TEXT.  Other arguments are
 	 * identical to parse_tokens_file().  */
 
+	static uint64_t hash_source;
+	/* Hash of all Stu source code read so far, i.e., of all input
+	 * files including their names, and of all -F arguments.  Used
+	 * to validate the manifest.  */
+
+	static void parse_tokens_file(vector <shared_ptr <Token> > &tokens, 
+				      Context context,
+				      Place &place_end,
+				      string filename, 
+				      vector <Trace> &traces,
+				      vector <string> &filenames,
+				      set <string> &includes,
+				      const Place &place_diagnostic,
+				      int fd= -1,
+				      bool allow_enoent= false);
+	/*
+	 * TRACES can include traces that lead to this inclusion.  TRACES must
+	 * not be modified when returning, but is declared as non-const
+	 * because it is used as a stack.  
+	 *
+	 * FILENAMES is the list of filenames parsed up to here. I.e., it has
+	 * length zero for the main read file.  FILENAME should *not* be
+	 * included in FILENAMES. 
+	 *
+	 * INCLUDES contains the files that were already read, and for
+	 * which %include is therefore ignored.  
+	 */
+
+	static set <string> filenames_source;
+	/* The names of all Stu source files read so far, excluding
+	 * standard input.  For directories, also contains the name of
+	 * the file "main.stu" within, which is actually read.  Used by
+	 * watch mode.  */
+
+	static map <string, set <string> > filenames_included;
+	/* For each Stu source file read so far, the files it includes
+	 * using %include, as given there, including those that were
+	 * ignored because they were already read.  A directory
+	 * includes the file "main.stu" within.  Standard input is
+	 * represented by "".  Used by watch mode.  */
+
 private:
 
 	/* Stacks of included files */ 
@@ -154,26 +198,6 @@ private:
 			     line, p - p_line); 
 	}
 
-	static void parse_tokens_file(vector <shared_ptr <Token> > &tokens, 
-				      Context context,
-				      Place &place_end,
-				      string filename, 
-				      vector <Trace> &traces,
-				      vector <string> &filenames,
-				      set <string> &includes,
-				      const Place &place_diagnostic,
-				      int fd= -1,
-				      bool allow_enoent= false);
-	/*
-	 * TRACES can include traces that lead to this inclusion.  TRACES must
-	 * not be modified when returning, but is declared as non-const
-	 * because it is used as a stack.  
-	 *
-	 * FILENAMES is the list of filenames parsed up to here. I.e., it has
-	 * length zero for the main read file.  FILENAME should *not* be
-	 * included in FILENAMES. 
-	 */
-
 	static bool is_name_char(char);
 	/* Whether the given character can be used as part of a bare
 	 * filename in Stu.  Note that all non-ASCII characters are
@@ -191,8 +215,23 @@ private:
 				  const Place &place_percent); 
 	/* Parse a version directive.  VERSION_REQ is the version number
 	 * given after "%version", and PLACE its place.  */
+
+	static void hash_add(const char *p, size_t size);
+	/* Add the given bytes to HASH_SOURCE, using FNV-1a */
 };
 
+uint64_t Tokenizer::hash_source= 0xcbf29ce484222325;
+set <string> Tokenizer::filenames_source;
+map <string, set <string> > Tokenizer::filenames_included;
+
+void Tokenizer::hash_add(const char *p, size_t size)
+{
+	for (size_t i= 0;  i < size;  ++i) {
+		hash_source ^= (unsigned char) p[i];
+		hash_source *= 0x100000001b3;
+	}
+}
+
 void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens, 
 				  Context context,
 				  Place &place_end,
@@ -204,6 +243,8 @@ void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens,
 				  int fd,
 				  bool allow_enoent)
 {
+	Counters::Timing timing(Counters::T_TOKENIZE); 
+
 	const char *in= nullptr;
 	size_t in_size;
 	struct stat buf;
@@ -219,6 +260,9 @@ void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens,
 			       filenames[filenames.size() - 1] != filename); 
 			assert(includes.count(filename) == 0); 
 			includes.insert(filename); 
+			hash_add(filename.c_str(), filename.size() + 1); 
+			if (filename != "")
+				filenames_source.insert(filename); 
 		} else {
 			assert(filenames.size() == 0);
 			assert(traces.size() == 0);
@@ -232,6 +276,7 @@ void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens,
 		}
 
 		if (fd < 0) {
+			Counters::add(Counters::C_OPEN); 
 			fd= open(filename.c_str(), O_RDONLY); 
 			if (fd < 0) {
 				if (allow_enoent) {
@@ -249,9 +294,15 @@ void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens,
 
 		/* If the file is a directory, open the file "main.stu" within it */ 
 		if (S_ISDIR(buf.st_mode)) {
+			const string dir= filename; 
 			if (filename[filename.size() - 1] != '/')
 				filename += '/';
 			filename += FILENAME_INPUT_DEFAULT;
+			if (context == SOURCE) {
+				filenames_included[dir]= {filename}; 
+				filenames_source.insert(filename); 
+			}
+			Counters::add(Counters::C_OPEN); 
 			int fd2= openat(fd, FILENAME_INPUT_DEFAULT, O_RDONLY);
 			if (fd2 < 0) 
 				goto error_close;
@@ -264,6 +315,10 @@ void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens,
 				goto error_close;
 		}
 
+		/* The included files are recorded anew while tokenizing */
+		if (context == SOURCE)
+			filenames_included.erase(filename); 
+
 		/* Handle a file of zero length separately because mmap() may fail
 		 * on it, i.e., return an error and refuse to create a memory
 		 * map of length zero. */  
@@ -344,6 +399,10 @@ void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens,
 				goto error;
 		}
 
+		if (context == SOURCE)
+			hash_add(in, in_size); 
+		Counters::add(Counters::C_TOKENIZER_BYTES, in_size); 
+
 		{
 			Tokenizer tokenizer(traces, filenames, includes,
 					    Place(Place::Type::INPUT_FILE, filename, 1, 0), 
@@ -781,10 +840,11 @@ bool Tokenizer::is_operator_char(char c)
 bool Tokenizer::is_flag_char(char c)
 /* These correspond to persistent, optional and trivial dependencies,
  * respectively.  'p'/'o'/'t' were '!', '?' and '&' formerly.  The
- * others are new.  */
+ * others are new.  'r' and 'u' are not dependency flags, but are placed
+ * before the targets of a rule.  */
 {
 	return c == 'p' || c == 'o' || c == 't' || 
-		c == 'n' || c == '0';
+		c == 'n' || c == '0' || c == 'r' || c == 'u';
 }
 
 void Tokenizer::parse_version(string version_req, 
@@ -1014,6 +1074,9 @@ void Tokenizer::parse_tokens_string(vector <shared_ptr <Token> > &tokens,
 	vector <string> filenames;
 	set <string> includes;
 
+	if (context == OPTION_F)
+		hash_add(string_.c_str(), string_.size() + 1); 
+
 	Tokenizer parse(traces, filenames, includes, 
 			place_string, 
 			string_.c_str(), string_.size());
@@ -1210,6 +1273,7 @@ void Tokenizer::parse_directive(vector <shared_ptr <Token> > &tokens,
 		}
 			
 		const string filename_include= place_name->unparametrized();
+		filenames_included[place_base.text].insert(filename_include); 
 
 		Trace trace_stack
 			(place_name->place,
@@ -1277,6 +1341,61 @@ void Tokenizer::parse_directive(vector <shared_ptr <Token> > &tokens,
 
 		parse_version(version_required, place_version, place_percent); 
 				
+	} else if (name == "pool") {
+
+		if (context == DYNAMIC || context == OPTION_C) {
+			place_percent 
+				<< frmt("%s%%pool%s must not be used %s",
+					Color::word, Color::end,
+					context == DYNAMIC 
+					? "in dynamic dependencies" : "in dependencies"); 
+			throw ERROR_LOGICAL;
+		}
+
+		shared_ptr <Place_Name> place_name= parse_name(false); 
+		if (place_name == nullptr) {
+			current_place() <<
+				(p == p_end
+				 ? "expected the name of a pool"
+				 : fmt("expected the name of a pool, not %s", char_format_err(*p)));
+			place_percent << frmt("after %s%%pool%s",
+					      Color::word, Color::end); 
+			throw ERROR_LOGICAL;
+		}
+		if (place_name->get_n() != 0) {
+			place_name->place <<
+				fmt("name %s must not be parametrized",
+				    place_name->format_err());
+			place_percent << frmt("after %s%%pool%s",
+					      Color::word, Color::end); 
+			throw ERROR_LOGICAL;
+		}
+
+		skip_space(); 
+		Place place_capacity= current_place(); 
+		const char *const p_capacity= p;
+		while (p < p_end && is_name_char(*p)) {
+			++p;
+		}
+		const string capacity_text(p_capacity, p - p_capacity); 
+		errno= 0; 
+		char *endptr;
+		unsigned long capacity= strtoul(capacity_text.c_str(), &endptr, 10); 
+		if (capacity_text.empty() || *endptr != '\0' || errno != 0 
+		    || capacity == 0 || ! isdigit(capacity_text[0])) {
+			place_capacity <<
+				(capacity_text.empty() 
+				 ? "expected the capacity of the pool"
+				 : fmt("expected a positive capacity, not %s",
+				       name_format_err(capacity_text))); 
+			place_name->place << fmt("of pool %s",
+						 name_format_err(place_name->unparametrized())); 
+			throw ERROR_LOGICAL;
+		}
+
+		Pool::declare(place_name->unparametrized(), capacity,
+			      place_name->place); 
+
 	} else {
 		/* Invalid directive */ 
 		place_percent << 
@@ -0,0 +1,75 @@
+#ifndef TRIE_HH
+#define TRIE_HH
+
+/*
+ * A trie (prefix tree) of strings, in which each string is associated
+ * with a list of values.  Used as an index of parametrized rules by the
+ * constant beginnings and ends of their target names.  Strings are
+ * only inserted, and never removed.
+ */
+
+#include <map>
+
+class Trie
+{
+public:
+	Trie()
+		:  nodes(1)
+	{  }
+
+	void insert(const string &key, size_t value);
+	/* Associate VALUE with KEY.  The same key may be inserted
+	 * multiple times.  */
+
+	void find(const string &text, vector <size_t> &values) const;
+	/* Append to VALUES all values whose key is a prefix of TEXT,
+	 * including the empty key.  Values are appended in the order of
+	 * increasing key length, and not sorted otherwise.  */
+
+private:
+	struct Node
+	{
+		map <char, size_t> children;
+		/* Indexes into NODES */
+
+		vector <size_t> values;
+	};
+
+	vector <Node> nodes;
+	/* Element [0] is the root, i.e., it corresponds to the empty
+	 * key */
+};
+
+void Trie::insert(const string &key, size_t value)
+{
+	size_t k= 0;
+	for (char c:  key) {
+		auto i= nodes[k].children.find(c);
+		if (i == nodes[k].children.end()) {
+			size_t k_new= nodes.size();
+			nodes[k].children[c]= k_new;
+			nodes.resize(k_new + 1);
+			k= k_new;
+		} else {
+			k= i->second;
+		}
+	}
+	nodes[k].values.push_back(value);
+}
+
+void Trie::find(const string &text, vector <size_t> &values) const
+{
+	size_t k= 0;
+	for (size_t i= 0;  ;  ++i) {
+		values.insert(values.end(),
+			      nodes[k].values.begin(), nodes[k].values.end());
+		if (i == text.size())
+			break;
+		auto j= nodes[k].children.find(text[i]);
+		if (j == nodes[k].children.end())
+			break;
+		k= j->second;
+	}
+}
+
+#endif /* ! TRIE_HH */
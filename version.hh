@@ -1,12 +1,12 @@
-/* Automatically generated by sh/mkversion on 2020-03-18T19:53:42 */
+/* Automatically generated by sh/mkversion on 2026-10-17T03:45:48 */
 
 #ifndef VERSION_HH
 #define VERSION_HH
 
-#define STU_VERSION "2.6.1"
+#define STU_VERSION "2.7.0"
 
 #define STU_VERSION_MAJOR 2
-#define STU_VERSION_MINOR 6
-#define STU_VERSION_PATCH 1
+#define STU_VERSION_MINOR 7
+#define STU_VERSION_PATCH 0
 
 #endif /* ! VERSION_HH */
@@ -0,0 +1,588 @@
+#ifndef WATCH_HH
+#define WATCH_HH
+
+/*
+ * Watch mode, used with the -w option.  Stu reads its source code
+ * once, and then builds the targets over and over again, each time
+ * after a file on which the build depends was changed.
+ *
+ * All builds are performed in the same process.  The rule set, the
+ * cached executions and the results of stat() (see probe.hh) are kept
+ * from one build to the next.  When a file is changed, the cached
+ * executions that depend on it, directly or indirectly, are deleted
+ * (see Execution::invalidate()), and are created anew by the next
+ * build, which thus only checks and rebuilds those targets.  After
+ * each build, the executions that ran a job or had an error are also
+ * deleted, because their state only applies to that build.  For the
+ * graph to be reusable, builds are never aborted, i.e., -w implies
+ * -k.
+ *
+ * Stu uses inotify to watch the directories containing the files that
+ * were probed, and on each event calls stat() on the concerned file.
+ * Only when the result differs from the one known to the build is the
+ * file considered to be changed.  This filters out the events caused
+ * by the build itself.
+ *
+ * When a Stu source file is changed, only that file is read again.
+ * Files that it includes and that were already read are not read
+ * again.  Its rules replace those it contained before, and rules of
+ * files that are no longer included are dropped.  The rule set is
+ * then built anew, and all cached executions are deleted, but the
+ * results of stat() are kept.  When the source code cannot be read,
+ * the previous rules are kept, and no build is done until a source
+ * file is changed again.  When the source code could not be read at
+ * startup, nothing is kept, and Stu is executed anew once a source
+ * file is changed.
+ *
+ * Only available on Linux, as it uses inotify.
+ */
+
+#include <poll.h>
+
+#ifdef __linux__
+#    include <sys/inotify.h>
+#endif
+
+class Watch
+{
+public:
+	static void loop(vector <shared_ptr <const Dep> > &deps,
+			 bool target_default,
+			 const vector <string> &filenames);
+	/* Build DEPS repeatedly; does not return.  With TARGET_DEFAULT,
+	 * DEPS is the first target of the rules, and is determined
+	 * anew when the rules change.  FILENAMES are the Stu source
+	 * files given on the command line, as passed to
+	 * Parser::get_file(), with "-" for standard input.  */
+
+	static void wait_source(char **argv);
+	/* Wait until a Stu source file is changed, and then execute Stu
+	 * again.  Used when the source code could not be parsed.  */
+
+private:
+	static int fd_inotify;
+	/* -1 when not initialized */
+
+	static unordered_map <string, Probe::Result> states;
+	/* The known result of stat() for each watched file */
+
+	static unordered_map <int, string> dirs;
+	/* The watched directories, by watch descriptor.  Directory
+	 * names are as in filenames, i.e., "." for the current
+	 * directory.  */
+
+	static set <string> dirs_watched;
+	/* The values of DIRS */
+
+	static set <string> sources_pending;
+	/* The changed Stu source files that could not be read again
+	 * without error yet */
+
+	static void init();
+	/* Initialize inotify, and watch the Stu source files */
+
+	static void add_sources();
+	/* Watch the Stu source files that are not watched yet */
+
+	static bool add(const string &filename, bool &added);
+	/* Watch the directory containing the given file, and the file
+	 * itself if it is a directory.  Return false when this is not
+	 * possible.  ADDED is set to whether a new directory is watched;
+	 * otherwise it is not changed.  */
+
+	static void build(const vector <shared_ptr <const Dep> > &deps,
+			  long jobs);
+	/* Build DEPS once, with JOBS as given by the -j option */
+
+	static void update(set <string> &changed);
+	/* Watch the files probed by the build, and update STATES to the
+	 * results known to the build.  Add to CHANGED the files that
+	 * were changed during the build in directories that were not
+	 * yet watched.  */
+
+	static void wait(set <string> &changed);
+	/* Wait until a watched file is changed, and add the changed
+	 * files to CHANGED */
+
+	static void process(const char *buf, ssize_t size,
+			    set <string> &changed);
+	/* Process the given inotify events, adding the changed files
+	 * to CHANGED */
+
+	static bool apply(const set <string> &changed,
+			  vector <shared_ptr <const Dep> > &deps,
+			  bool target_default,
+			  const vector <string> &filenames);
+	/* Output the changed files, and invalidate the executions
+	 * depending on them.  Read changed Stu source files again.
+	 * Return whether the targets must be built, i.e., false when
+	 * the source code could not be read.  */
+
+	static bool reparse(vector <shared_ptr <const Dep> > &deps,
+			    bool target_default,
+			    const vector <string> &filenames);
+	/* Read the files in SOURCES_PENDING again, and replace the rule
+	 * set.  Return false when there was an error, in which case
+	 * the rule set is not changed.  */
+
+	static bool check(const string &filename);
+	/* Call stat() on the file, and update its state.  Return whether
+	 * it was changed.  */
+
+	static void stat(const string &filename, Probe::Result &result);
+
+	static bool same(const Probe::Result &a, const Probe::Result &b);
+	/* Whether two results of stat() describe the same file state */
+
+	static void reexec(char **argv);
+	/* Does not return */
+};
+
+int Watch::fd_inotify= -1;
+unordered_map <string, Probe::Result> Watch::states;
+unordered_map <int, string> Watch::dirs;
+set <string> Watch::dirs_watched;
+set <string> Watch::sources_pending;
+
+void Watch::loop(vector <shared_ptr <const Dep> > &deps,
+		 bool target_default,
+		 const vector <string> &filenames)
+{
+	init();
+	Probe::keep_filenames= true;
+	const long jobs= Execution::jobs;
+
+	while (true) {
+		build(deps, jobs);
+
+		set <string> changed;
+		update(changed);
+		while (changed.empty() ||
+		       ! apply(changed, deps, target_default, filenames)) {
+			changed.clear();
+			wait(changed);
+		}
+	}
+}
+
+void Watch::wait_source(char **argv)
+{
+	init();
+	while (true) {
+		set <string> changed;
+		wait(changed);
+		bool changed_source= false;
+		for (const string &filename:  changed) {
+			print_out(fmt("File %s was changed",
+				      Target(0, filename).format_out_print_word()));
+			if (Tokenizer::filenames_source.count(filename))
+				changed_source= true;
+		}
+		if (changed_source)
+			reexec(argv);
+	}
+}
+
+void Watch::init()
+{
+#ifdef __linux__
+	if (fd_inotify >= 0)
+		return;
+
+	fd_inotify= inotify_init1(IN_CLOEXEC);
+	if (fd_inotify < 0) {
+		print_error_system("inotify_init1");
+		exit(ERROR_FATAL);
+	}
+
+	add_sources();
+#else
+	print_error(fmt("Watch mode using %s is not available on this platform",
+			multichar_format_err("-w")));
+	exit(ERROR_FATAL);
+#endif
+}
+
+void Watch::add_sources()
+{
+	for (const string &filename:  Tokenizer::filenames_source) {
+		if (states.count(filename))
+			continue;
+		bool added;
+		stat(filename, states[filename]);
+		if (! add(filename, added))
+			states.erase(filename);
+	}
+}
+
+bool Watch::add(const string &filename, bool &added)
+{
+#ifdef __linux__
+	const uint32_t mask= IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+		| IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF
+		| IN_MOVE_SELF;
+
+	size_t pos= filename.rfind('/');
+	string dir= pos == string::npos ? "."
+		: pos == 0 ? "/" : filename.substr(0, pos);
+
+	vector <string> dirs_new{dir};
+	auto i= states.find(filename);
+	if (i != states.end() && i->second.ret == 0 && S_ISDIR(i->second.buf.st_mode))
+		dirs_new.push_back(filename);
+
+	for (const string &d:  dirs_new) {
+		if (dirs_watched.count(d))
+			continue;
+		int wd= inotify_add_watch(fd_inotify, d.c_str(), mask);
+		if (wd < 0)
+			return false;
+		dirs[wd]= d;
+		dirs_watched.insert(d);
+		added= true;
+	}
+	return true;
+#else
+	(void) filename;
+	(void) added;
+	return false;
+#endif
+}
+
+void Watch::build(const vector <shared_ptr <const Dep> > &deps,
+		  long jobs)
+{
+	Timestamp::startup= Timestamp::now();
+	Execution::jobs= jobs;
+	try {
+		Execution::main(deps);
+	} catch (int e) {
+		/* The errors were already output */
+		assert(e >= 1 && e <= 3);
+	}
+
+	if (Digest::filename)
+		Digest::write();
+	if (History::filename)
+		History::write();
+	Timeline::flush();
+	Accounting::write();
+	Counters::write();
+
+	Execution::invalidate_stale();
+}
+
+void Watch::update(set <string> &changed)
+{
+	vector <string> filenames;
+	swap(filenames, Probe::filenames_touched);
+	sort(filenames.begin(), filenames.end());
+	filenames.erase(unique(filenames.begin(), filenames.end()),
+			filenames.end());
+
+	for (const string &filename:  filenames) {
+		/* The result on which the build is based, which is
+		 * compared with the file when an event arrives */
+		Probe::Result &state= states[filename];
+		auto i= Probe::get_results().find(filename);
+		if (i != Probe::get_results().end()) {
+			state= i->second;
+		} else {
+			stat(filename, state);
+			Probe::set(filename, state);
+		}
+
+		bool added= false;
+		if (! add(filename, added)) {
+			states.erase(filename);
+			continue;
+		}
+
+		/* The file may have been changed before its directory was
+		 * watched */
+		if (added && check(filename))
+			changed.insert(filename);
+	}
+}
+
+void Watch::wait(set <string> &changed)
+{
+#ifdef __linux__
+	alignas(struct inotify_event) char buf[0x10000];
+
+	while (changed.empty()) {
+		ssize_t size= read(fd_inotify, buf, sizeof(buf));
+		if (size < 0) {
+			if (errno == EINTR)
+				continue;
+			print_error_system("read");
+			exit(ERROR_FATAL);
+		}
+		process(buf, size, changed);
+	}
+
+	/* Editors often write a file in multiple steps; wait until no
+	 * more events arrive */
+	struct pollfd pfd;
+	pfd.fd= fd_inotify;
+	pfd.events= POLLIN;
+	while (poll(&pfd, 1, 100) > 0) {
+		ssize_t size= read(fd_inotify, buf, sizeof(buf));
+		if (size <= 0)
+			break;
+		process(buf, size, changed);
+	}
+#else
+	(void) changed;
+#endif
+}
+
+void Watch::process(const char *buf, ssize_t size,
+		    set <string> &changed)
+{
+#ifdef __linux__
+	for (const char *p= buf;  p < buf + size;) {
+		const struct inotify_event *event=
+			(const struct inotify_event *) p;
+		p += sizeof(struct inotify_event) + event->len;
+
+		vector <string> filenames;
+		if (event->mask & IN_Q_OVERFLOW) {
+			/* Events were lost:  check all files */
+			for (const auto &i:  states)
+				filenames.push_back(i.first);
+		} else {
+			auto i= dirs.find(event->wd);
+			if (i == dirs.end())
+				continue;
+			const string dir= i->second;
+			if (event->mask & IN_IGNORED) {
+				/* The directory was removed; it is watched
+				 * again when it is seen in a build */
+				dirs_watched.erase(dir);
+				dirs.erase(i);
+				string prefix= dir == "/" ? dir : dir + '/';
+				for (const auto &j:  states) {
+					if (dir == "." ? j.first.find('/') == string::npos
+					    : j.first.compare(0, prefix.size(), prefix) == 0)
+						filenames.push_back(j.first);
+				}
+			} else if (event->len) {
+				filenames.push_back(dir == "." ? string(event->name)
+						    : dir == "/" ? dir + event->name
+						    : dir + '/' + event->name);
+			}
+			filenames.push_back(dir);
+		}
+
+		for (const string &filename:  filenames) {
+			if (states.count(filename) && check(filename))
+				changed.insert(filename);
+		}
+	}
+#else
+	(void) buf;
+	(void) size;
+	(void) changed;
+#endif
+}
+
+bool Watch::apply(const set <string> &changed,
+		  vector <shared_ptr <const Dep> > &deps,
+		  bool target_default,
+		  const vector <string> &filenames)
+{
+	vector <Target> targets;
+	bool changed_source= false;
+	for (const string &filename:  changed) {
+		print_out(fmt("File %s was changed",
+			      Target(0, filename).format_out_print_word()));
+		targets.push_back(Target(0, filename));
+
+		/* A directory given as source stands for the file
+		 * "main.stu" within, which is watched itself */
+		const Probe::Result &state= states.at(filename);
+		if (Tokenizer::filenames_source.count(filename)
+		    && ! (state.ret == 0 && S_ISDIR(state.buf.st_mode))) {
+			sources_pending.insert(filename);
+			changed_source= true;
+		}
+	}
+
+	Execution::invalidate(targets);
+
+	if (sources_pending.empty())
+		return true;
+	if (! changed_source || ! reparse(deps, target_default, filenames))
+		return false;
+	sources_pending.clear();
+	return true;
+}
+
+bool Watch::reparse(vector <shared_ptr <const Dep> > &deps,
+		    bool target_default,
+		    const vector <string> &filenames)
+{
+	/* The files that are not read again are ignored when they are
+	 * included */
+	set <string> includes;
+	for (const string &filename:  Tokenizer::filenames_source) {
+		if (! sources_pending.count(filename))
+			includes.insert(filename);
+	}
+	const set <string> includes_old= includes;
+
+	/* Visit the source files starting at those given on the command
+	 * line, reading the changed ones before following their
+	 * inclusions.  Changed files that are not reached anymore are not
+	 * read.  */
+	set <string> filenames_reached;
+	map <string, vector <shared_ptr <Rule> > > rules_read;
+	/* By changed file, the rules read from it, including from the
+	 * files it includes for the first time */
+	vector <string> filenames_todo;
+	for (auto i= filenames.rbegin();  i != filenames.rend();  ++i)
+		filenames_todo.push_back(*i == "-" ? "" : *i);
+	try {
+		while (! filenames_todo.empty()) {
+			string filename= filenames_todo.back();
+			filenames_todo.pop_back();
+			if (! filenames_reached.insert(filename).second)
+				continue;
+
+			if (sources_pending.count(filename) && ! includes.count(filename)) {
+				vector <shared_ptr <Token> > tokens;
+				Place place_end;
+				vector <Trace> traces;
+				vector <string> filenames_include;
+				Tokenizer::parse_tokens_file
+					(tokens, Tokenizer::SOURCE, place_end, filename,
+					 traces, filenames_include, includes, Place());
+				shared_ptr <const Place_Param_Target> target_first;
+				Parser::get_rule_list(rules_read[filename], tokens,
+						      place_end, target_first);
+			}
+
+			auto i= Tokenizer::filenames_included.find(filename);
+			if (i == Tokenizer::filenames_included.end())
+				continue;
+			for (auto j= i->second.rbegin();  j != i->second.rend();  ++j)
+				filenames_todo.push_back(*j);
+		}
+	} catch (int e) {
+		assert(e >= 1 && e <= 3);
+		return false;
+	}
+
+	/* The files whose previous rules are replaced */
+	set <string> filenames_read;
+	set_difference(includes.begin(), includes.end(),
+		       includes_old.begin(), includes_old.end(),
+		       inserter(filenames_read, filenames_read.end()));
+
+	/* The new rules replace those of the first file that was read
+	 * again, and are appended when that file had no rules.  Rules
+	 * of files that are not included anymore are dropped.  Rules
+	 * not from files, i.e., from -F, are kept.  */
+	vector <shared_ptr <Rule> > rules;
+	for (const shared_ptr <Rule> &rule:  Execution::rule_set.get_rules()) {
+		const Place &place= rule->place;
+		if (place.type != Place::Type::INPUT_FILE) {
+			rules.push_back(rule);
+			continue;
+		}
+		if (! filenames_reached.count(place.text))
+			continue;
+		if (! filenames_read.count(place.text)) {
+			rules.push_back(rule);
+			continue;
+		}
+		auto i= rules_read.find(place.text);
+		if (i == rules_read.end())
+			continue;
+		rules.insert(rules.end(), i->second.begin(), i->second.end());
+		rules_read.erase(i);
+	}
+	for (const auto &i:  rules_read)
+		rules.insert(rules.end(), i.second.begin(), i.second.end());
+
+	Rule_Set rule_set;
+	try {
+		rule_set.add(rules);
+	} catch (int e) {
+		assert(e >= 1 && e <= 3);
+		return false;
+	}
+
+	if (target_default) {
+		if (rules.empty()) {
+			print_error("No rules and no targets given");
+			return false;
+		}
+		shared_ptr <const Place_Param_Target> target_first=
+			rules.front()->place_param_targets.front();
+		if (target_first->place_name.is_parametrized()) {
+			target_first->place <<
+				fmt("the first target %s must not be parametrized if no target is given",
+				    target_first->format_err());
+			return false;
+		}
+		deps= {make_shared <Plain_Dep> (*target_first)};
+	}
+
+	Execution::invalidate_all();
+	Execution::rule_set= move(rule_set);
+	add_sources();
+	return true;
+}
+
+bool Watch::check(const string &filename)
+{
+	Probe::Result result;
+	stat(filename, result);
+	Probe::Result &state= states.at(filename);
+	if (same(state, result))
+		return false;
+
+	state= result;
+	Probe::set(filename, result);
+	return true;
+}
+
+void Watch::stat(const string &filename, Probe::Result &result)
+{
+	result.ret= ::stat(filename.c_str(), &result.buf);
+	result.errno_stat= result.ret == 0 ? 0 : errno;
+}
+
+bool Watch::same(const Probe::Result &a, const Probe::Result &b)
+{
+	if (a.ret != 0 || b.ret != 0)
+		return a.ret == b.ret && a.errno_stat == b.errno_stat;
+
+	/* Nanosecond precision is used where available regardless of
+	 * USE_MTIM, as a file may be changed more than once within a
+	 * second */
+#if defined(__APPLE__)
+	if (a.buf.st_mtimespec.tv_nsec != b.buf.st_mtimespec.tv_nsec)
+		return false;
+#elif USE_MTIM || defined(__linux__)
+	if (a.buf.st_mtim.tv_nsec != b.buf.st_mtim.tv_nsec)
+		return false;
+#endif
+	return a.buf.st_mtime == b.buf.st_mtime
+		&& a.buf.st_size == b.buf.st_size
+		&& a.buf.st_ino == b.buf.st_ino
+		&& a.buf.st_dev == b.buf.st_dev
+		&& a.buf.st_mode == b.buf.st_mode;
+}
+
+void Watch::reexec(char **argv)
+{
+	fflush(stdout);
+	execvp(argv[0], argv);
+	print_error_system(argv[0]);
+	exit(ERROR_FATAL);
+}
+
+#endif /* ! WATCH_HH */